@@ -20,7 +20,20 @@ SOURCES += main.cpp \
     capturethread.cpp \
     imagebuffer.cpp \
     FrameLabel.cpp \
-    stereomodule.cpp
+    stereomodule.cpp \
+    frame.cpp \
+    framepacer.cpp \
+    videodecoder.cpp \
+    latencystats.cpp \
+    filterstage.cpp \
+    filterpipeline.cpp \
+    stagedexecutor.cpp \
+    tiledexecutor.cpp \
+    imagecache.cpp \
+    parallel.cpp \
+    fusedkernels.cpp \
+    boxgaussian.cpp \
+    morphology.cpp
 
 HEADERS  += \
     structures.h \
@@ -32,7 +45,21 @@ HEADERS  += \
     capturethread.h \
     imagebuffer.h \
     FrameLabel.h \
-    stereomodule.h
+    stereomodule.h \
+    frame.h \
+    framepacer.h \
+    videodecoder.h \
+    latencystats.h \
+    filterstage.h \
+    filterpipeline.h \
+    stagedexecutor.h \
+    tiledexecutor.h \
+    imagecache.h \
+    parallel.h \
+    fusedkernels.h \
+    boxgaussian.h \
+    morphology.h \
+    atomicint.h
 
 FORMS    += \
     mainwindow.ui \
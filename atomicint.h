@@ -0,0 +1,28 @@
+#ifndef ATOMICINT_H
+#define ATOMICINT_H
+
+#include <QAtomicInt>
+
+// Acquire loads and release stores of a QAtomicInt. Qt 5 has them as
+// members; Qt 4 only has the read-modify-write operations, whose ordered
+// forms are at least as strong, so both versions build.
+
+inline int loadAcquire(const QAtomicInt &a)
+{
+#if QT_VERSION >= 0x050000
+    return a.loadAcquire();
+#else
+    return const_cast<QAtomicInt&>(a).fetchAndAddOrdered(0);
+#endif
+}
+
+inline void storeRelease(QAtomicInt &a, int v)
+{
+#if QT_VERSION >= 0x050000
+    a.storeRelease(v);
+#else
+    a.fetchAndStoreOrdered(v);
+#endif
+}
+
+#endif // ATOMICINT_H
@@ -0,0 +1,128 @@
+// Times cv::GaussianBlur against the stacked-box approximation for every
+// kernel size up to a maximum, for each sigma given (0: derived from the
+// size, as OpenCV does), and reports how far apart the results are, to
+// place DEFAULT_BLUR_BOX_SIZE. Sizes the boxes do not fit
+// (boxGaussianFits()) are only timed exactly.
+//
+//   gaussianbench [image [max size [runs [sigma...]]]]
+//
+// Without an image (or "-") a 1280x720 colour test pattern is used; the
+// default sigmas are 0, the application's 0.1, 1.5, 3 and 5.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+#include "boxgaussian.h"
+
+// Random texture on top of gradients, so both smooth areas and edges count
+static cv::Mat testPattern()
+{
+    cv::Mat image(720, 1280, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    for (int y=0; y<image.rows; y+=1)
+    {
+        cv::Vec3b *row = image.ptr<cv::Vec3b>(y);
+        for (int x=0; x<image.cols; x+=1)
+        {
+            row[x][0] = (uchar) ((row[x][0] + 255 * x / image.cols) / 2);
+            row[x][1] = (uchar) ((row[x][1] + 255 * y / image.rows) / 2);
+        }
+    }
+    cv::rectangle(image, cv::Point(400, 200), cv::Point(880, 520), cv::Scalar(255, 255, 255), -1);
+    return image;
+}
+
+// Milliseconds per call, best of runs
+template<typename Blur>
+static double timeIt(Blur blur, int runs)
+{
+    double best = 1e30;
+    for (int i=0; i<runs; i+=1)
+    {
+        int64 start = cv::getTickCount();
+        blur();
+        double ms = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+        if (ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+struct Exact {
+    const cv::Mat *src; cv::Mat *dst; int size; double sigma;
+    void operator()() const { cv::GaussianBlur(*src, *dst, cv::Size(size, size), sigma); }
+};
+
+struct Boxes {
+    const cv::Mat *src; cv::Mat *dst; int size; double sigma; cv::Mat *tmp;
+    void operator()() const { boxGaussian(*src, *dst, size, sigma, tmp); }
+};
+
+int main(int argc, char *argv[])
+{
+    cv::Mat src;
+    if (argc > 1 && strcmp(argv[1], "-") != 0)
+    {
+        src = cv::imread(argv[1]);
+        if (src.empty())
+        {
+            fprintf(stderr, "cannot read %s\n", argv[1]);
+            return 1;
+        }
+    }
+    else
+        src = testPattern();
+    int maxSize = argc > 2 ? atoi(argv[2]) : 61;
+    int runs    = argc > 3 ? atoi(argv[3]) : 10;
+    std::vector<double> sigmas;
+    for (int i=4; i<argc; i+=1)
+        sigmas.push_back(atof(argv[i]));
+    if (sigmas.empty())
+    {
+        const double defaults[] = { 0, 0.1, 1.5, 3, 5 };
+        sigmas.assign(defaults, defaults + 5);
+    }
+
+    printf("%dx%d, %d channels, best of %d runs\n", src.cols, src.rows, src.channels(), runs);
+    printf("%5s %7s %-11s %10s %10s %8s %9s %9s\n",
+           "size", "sigma", "boxes", "exact ms", "boxes ms", "speedup", "mean err", "max err");
+
+    cv::Mat exact, approx, tmp[2], diff;
+    for (size_t k=0; k<sigmas.size(); k+=1)
+    {
+        double sigma = sigmas[k];
+        for (int size=3; size<=maxSize; size+=2)
+        {
+            Exact e = { &src, &exact, size, sigma };
+            double exactMs = timeIt(e, runs);
+            double s = gaussianSigma(size, sigma);
+            if (!boxGaussianFits(size, sigma))
+            {
+                printf("%5d %7.2f %-11s %10.3f\n", size, s, "-", exactMs);
+                continue;
+            }
+            Boxes b = { &src, &approx, size, sigma, tmp };
+            double boxesMs = timeIt(b, runs);
+
+            cv::absdiff(exact, approx, diff);
+            cv::Scalar mean = cv::mean(diff);
+            double meanErr = 0;
+            for (int c=0; c<src.channels(); c+=1)
+                meanErr += mean[c] / src.channels();
+            double maxErr;
+            cv::minMaxLoc(diff.reshape(1), 0, &maxErr);
+
+            int widths[BOX_PASSES];
+            boxWidths(s, widths);
+            char boxes[32];
+            sprintf(boxes, "%d,%d,%d", widths[0], widths[1], widths[2]);
+
+            printf("%5d %7.2f %-11s %10.3f %10.3f %7.2fx %9.3f %9.0f\n",
+                   size, s, boxes, exactMs, boxesMs, exactMs / boxesMs, meanErr, maxErr);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Exact against stacked-box Gaussian blur: time and error per kernel size
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console
+CONFIG   -= app_bundle qt
+
+TARGET = gaussianbench
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += gaussianbench.cpp \
+    ../boxgaussian.cpp
+
+HEADERS  += \
+    ../boxgaussian.h
+
+LIBS += -lopencv_core -lopencv_imgproc -lopencv_highgui
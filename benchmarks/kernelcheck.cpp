@@ -0,0 +1,154 @@
+// Checks the fused kernels and the square morphology against the OpenCV
+// chains they replace in the stages, on random 1- and 3-channel images
+// with widths on both sides of the 8- and 16-byte vector steps. Every case
+// that differs is printed; the exit code is 1 if there was one.
+//
+//   kernelcheck [seed]
+
+#include <cstdio>
+#include <cstdlib>
+#include <opencv/cv.h>
+#include "fusedkernels.h"
+#include "morphology.h"
+
+static int cases    = 0;
+static int declined = 0;
+static int failures = 0;
+
+// Random pixels, a quarter of them set to 0 or 255 so the sums saturate
+static cv::Mat randomImage(cv::RNG &rng, int rows, int cols, int cn)
+{
+    cv::Mat image(rows, cols, CV_8UC(cn));
+    rng.fill(image, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+    for (int i=0; i<rows*cols/4; i+=1)
+    {
+        uchar *p = image.ptr<uchar>(rng.uniform(0, rows)) + rng.uniform(0, cols) * cn;
+        for (int c=0; c<cn; c+=1)
+            p[c] = (i & 1) ? 255 : 0;
+    }
+    return image;
+}
+
+static void compare(const char *what, const cv::Mat &src, const cv::Mat &got, const cv::Mat &expected)
+{
+    cases += 1;
+    cv::Mat diff;
+    cv::absdiff(got, expected, diff);
+    diff = diff.reshape(1);
+    int wrong = cv::countNonZero(diff);
+    if (wrong == 0)
+        return;
+    failures += 1;
+    double maxErr;
+    cv::Point at;
+    cv::minMaxLoc(diff, 0, &maxErr, 0, &at);
+    printf("%-18s %3dx%-3d %d ch: %d values differ, by up to %.0f at (%d, %d)\n",
+           what, src.cols, src.rows, src.channels(), wrong, maxErr, at.x / src.channels(), at.y);
+}
+
+// What SobelStage and LaplacianStage ran before the fused kernels
+static void sobelChain(const cv::Mat &src, cv::Mat &dst, int direction, int ksize)
+{
+    cv::Mat gradX, gradY, absX, absY;
+    cv::Sobel(src, gradX, CV_16S, 1, 0, ksize, 1, 0, cv::BORDER_DEFAULT);
+    cv::Sobel(src, gradY, CV_16S, 0, 1, ksize, 1, 0, cv::BORDER_DEFAULT);
+    cv::convertScaleAbs(gradX, absX);
+    cv::convertScaleAbs(gradY, absY);
+    if (direction == 0)
+        dst = absX;
+    else if (direction == 1)
+        dst = absY;
+    else
+        cv::addWeighted(absX, 0.5, absY, 0.5, 0, dst);
+}
+
+static void laplacianChain(const cv::Mat &src, cv::Mat &dst, int ksize)
+{
+    cv::Mat laplace;
+    cv::Laplacian(src, laplace, CV_16S, ksize, 1, 0, cv::BORDER_DEFAULT);
+    cv::convertScaleAbs(laplace, dst);
+}
+
+static void sharpenChain(const cv::Mat &src, cv::Mat &dst, int center)
+{
+    cv::Mat kernel(3, 3, CV_32F, cv::Scalar(0));
+    kernel.at<float>(1,1) = center;
+    kernel.at<float>(0,1) = -1.0;
+    kernel.at<float>(2,1) = -1.0;
+    kernel.at<float>(1,0) = -1.0;
+    kernel.at<float>(1,2) = -1.0;
+    cv::filter2D(src, dst, src.depth(), kernel);
+}
+
+static void checkImage(const cv::Mat &src)
+{
+    cv::Mat got, expected, g, h;
+    char what[32];
+
+    for (int ksize=1; ksize<=3; ksize+=2)
+    {
+        for (int direction=0; direction<3; direction+=1)
+        {
+            sprintf(what, "sobel d%d k%d", direction, ksize);
+            if (!fusedSobel(src, got, direction, ksize))
+            {
+                declined += 1;
+                continue;
+            }
+            sobelChain(src, expected, direction, ksize);
+            compare(what, src, got, expected);
+        }
+        sprintf(what, "laplacian k%d", ksize);
+        if (fusedLaplacian(src, got, ksize))
+        {
+            laplacianChain(src, expected, ksize);
+            compare(what, src, got, expected);
+        }
+        else
+            declined += 1;
+    }
+
+    // The spin box goes up to 9; the kernel takes up to 64
+    const int centers[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 16, 32, 64 };
+    for (int i=0; i<13; i+=1)
+    {
+        sprintf(what, "sharpen c%d", centers[i]);
+        if (!fusedSharpen(src, got, centers[i]))
+        {
+            declined += 1;
+            continue;
+        }
+        sharpenChain(src, expected, centers[i]);
+        compare(what, src, got, expected);
+    }
+
+    for (int radius=0; radius<=8; radius+=1)
+    {
+        sprintf(what, "dilate r%d", radius);
+        squareMorphology(src, got, true, radius, g, h);
+        cv::dilate(src, expected, cv::Mat(), cv::Point(-1, -1), radius);
+        compare(what, src, got, expected);
+
+        sprintf(what, "erode r%d", radius);
+        squareMorphology(src, got, false, radius, g, h);
+        cv::erode(src, expected, cv::Mat(), cv::Point(-1, -1), radius);
+        compare(what, src, got, expected);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    cv::RNG rng(argc > 1 ? atoi(argv[1]) : 1);
+
+    // Around the scalar edges and the 8- and 16-byte steps
+    const int widths[]  = { 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 33, 64, 65 };
+    const int heights[] = { 1, 2, 3, 5, 40 };
+    for (int cn=1; cn<=3; cn+=2)
+        for (int w=0; w<13; w+=1)
+            for (int h=0; h<5; h+=1)
+                checkImage(randomImage(rng, heights[h], widths[w], cn));
+
+    printf("%d cases compared, %d left to OpenCV by the kernels, %d differ\n",
+           cases, declined, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# Fused kernels and square morphology against the OpenCV chains they replace
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console
+CONFIG   -= app_bundle qt
+
+TARGET = kernelcheck
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += kernelcheck.cpp \
+    ../fusedkernels.cpp \
+    ../morphology.cpp
+
+HEADERS  += \
+    ../fusedkernels.h \
+    ../morphology.h
+
+LIBS += -lopencv_core -lopencv_imgproc
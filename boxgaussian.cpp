@@ -0,0 +1,68 @@
+#include "boxgaussian.h"
+#include <cmath>
+#include <algorithm>
+
+int gaussianWidth(int size, double sigma)
+{
+    if (size > 0)
+        return size;
+    return cvRound(sigma * 3 * 2 + 1) | 1;
+}
+
+double gaussianSigma(int size, double sigma)
+{
+    if (sigma > 0)
+        return sigma;
+    return 0.3 * ((size - 1) * 0.5 - 1) + 0.8;
+}
+
+void boxWidths(double sigma, int widths[])
+{
+    // A box of width w has variance (w*w - 1)/12. The first m boxes take
+    // the odd width below the ideal one and the rest the odd width above
+    // (W. Wells, "Efficient synthesis of Gaussian filters by cascaded
+    // uniform filters", 1986; widths as in P. Kovesi, 2010).
+    double variance = sigma * sigma;
+    double ideal = std::sqrt(12 * variance / BOX_PASSES + 1);
+    int lower = (int) ideal;
+    if (lower % 2 == 0)
+        lower -= 1;
+    lower = std::max(lower, 1);
+    int m = cvRound((12 * variance - BOX_PASSES * lower * lower - 4 * BOX_PASSES * lower - 3 * BOX_PASSES)
+                    / (-4.0 * lower - 4));
+    for (int i=0; i<BOX_PASSES; i+=1)
+        widths[i] = (i < m) ? lower : lower + 2;
+}
+
+bool boxGaussianFits(int size, double sigma)
+{
+    double s = gaussianSigma(size, sigma);
+    int widths[BOX_PASSES];
+    boxWidths(s, widths);
+    // widths[0] is the narrowest
+    return 3 * s <= gaussianWidth(size, sigma) / 2.0 && widths[0] >= 3;
+}
+
+int boxGaussianRadius(int size, double sigma)
+{
+    int widths[BOX_PASSES];
+    boxWidths(gaussianSigma(size, sigma), widths);
+    int radius = 0;
+    for (int i=0; i<BOX_PASSES; i+=1)
+        radius += widths[i] / 2;
+    return radius;
+}
+
+void boxGaussian(const cv::Mat &src, cv::Mat &dst, int size, double sigma, cv::Mat tmp[2])
+{
+    int widths[BOX_PASSES];
+    boxWidths(gaussianSigma(size, sigma), widths);
+
+    const cv::Mat *in = &src;
+    for (int i=0; i<BOX_PASSES; i+=1)
+    {
+        cv::Mat &out = (i == BOX_PASSES - 1) ? dst : tmp[i & 1];
+        cv::blur(*in, out, cv::Size(widths[i], widths[i]));
+        in = &out;
+    }
+}
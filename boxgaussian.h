@@ -0,0 +1,34 @@
+#ifndef BOXGAUSSIAN_H
+#define BOXGAUSSIAN_H
+
+#include <opencv/cv.h>
+
+// Gaussian blur approximated by box filters applied one after the other.
+// A box filter costs the same at any width (OpenCV keeps running sums),
+// so the blur does too, while cv::GaussianBlur grows with the kernel.
+// Three boxes keep the mean difference to the exact blur under a grey
+// level, with single pixels off by up to about ten.
+
+#define BOX_PASSES 3
+
+// The kernel width and sigma cv::GaussianBlur uses for 8-bit images when
+// one of them is 0 (it derives it from the other)
+int gaussianWidth(int size, double sigma);
+double gaussianSigma(int size, double sigma);
+
+// Odd widths of the BOX_PASSES boxes whose variances add up closest to
+// sigma squared
+void boxWidths(double sigma, int widths[]);
+// Whether the boxes stand in for cv::GaussianBlur with these parameters:
+// they are sized from sigma alone, so the exact kernel must hold the
+// Gaussian out to 3 sigma, and below sigma ~1.4 boxes are too coarse
+bool boxGaussianFits(int size, double sigma);
+// Rows and columns the stacked boxes reach on each side
+int boxGaussianRadius(int size, double sigma);
+
+// Approximates cv::GaussianBlur(src, dst, Size(size, size), sigma), with the
+// same border handling; tmp holds the passes in between. dst must not share
+// memory with src.
+void boxGaussian(const cv::Mat &src, cv::Mat &dst, int size, double sigma, cv::Mat tmp[2]);
+
+#endif // BOXGAUSSIAN_H
@@ -6,8 +6,14 @@
 CaptureThread::CaptureThread(ImageBuffer *imageBuffer)
     : QThread()
     , inputBuffer(imageBuffer)
+    , stillImagePending(false)
     , stopped(false)
     , paused(false)
+    , inputMode(0)
+    , sourceId(0)
+    , source(-1)
+    , sequence(0)
+    , workingSize(DEFAULT_WORKING_WIDTH, DEFAULT_WORKING_HEIGHT)
 {
 }
 
@@ -15,79 +21,178 @@ void CaptureThread::run()
 {
     while(1)
     {
-        // Check if it is paused
-        pauseMutex.lock();
-        if (paused)
-        {
-            pauseMutex.unlock();
-            sleep(3);
-            continue;
-        }
-        pauseMutex.unlock();
+        // Sleep while paused; play() and stop wake us up right away
+        stateMutex.lock();
+        bool wasPaused = paused;
+        while (paused && !stopped)
+            stateChanged.wait(&stateMutex);
 
         /////////////////////////////////
         // Stop thread if stopped=TRUE //
         /////////////////////////////////
-        stoppedMutex.lock();
         if (stopped)
         {
             stopped=false;
-            stoppedMutex.unlock();
+            stateMutex.unlock();
             break;
         }
-        stoppedMutex.unlock();
+        stateMutex.unlock();
 
-        inputMutex.lock();
-        if (inputMode != INPUT_IMAGE)
+        if (wasPaused)
         {
-            inputMutex.unlock();
-            // Capture a frame
+            // resume on the next frame instead of catching up
             capMutex.lock();
-                cap >> grabbedFrame;
+            pacer.reset();
             capMutex.unlock();
-            // resize the frame to fit in the UI frames
-            cv::resize(grabbedFrame, grabbedFrame, cv::Size(332, 232));
         }
-        inputMutex.unlock();
-
-        // add the frame to the buffer
-        inputBuffer->addFrame(grabbedFrame.clone());
 
         inputMutex.lock();
-        if (inputMode == INPUT_VIDEO)
+        int mode = inputMode;
+        if (source != sourceId)
         {
-            inputMutex.unlock();
-            capMutex.lock();
-            if (cap.get(CV_CAP_PROP_FRAME_COUNT)-1 == cap.get(CV_CAP_PROP_POS_FRAMES))
+            // Another input was opened: number its frames from 0
+            source   = sourceId;
+            sequence = 0;
+        }
+        if (mode == INPUT_IMAGE)
+        {
+            // Nothing to do until the image is loaded or refreshed; a stop
+            // request or another input wakes us too
+            while (inputMode == INPUT_IMAGE && !stillImagePending && !isStopped())
+                stillImageChanged.wait(&inputMutex);
+            if (inputMode != INPUT_IMAGE)
             {
-                cap.set(CV_CAP_PROP_POS_FRAMES, 0);
+                // a video or camera was opened meanwhile: start over with it
+                inputMutex.unlock();
+                continue;
             }
+            if (stillImagePending)
+                grabbedFrame = stillImage;
+            else
+                grabbedFrame.release();
+            stillImagePending = false;
+        }
+        inputMutex.unlock();
+
+        if (mode == INPUT_VIDEO)
+        {
+            // Drop the frames we are already too late for
+            capMutex.lock();
+            int skip = pacer.framesToSkip();
             capMutex.unlock();
-            msleep(1000/cap.get(CV_CAP_PROP_FPS));
+            if (skip > 0)
+                decoder.skipFrames(skip);
+            // Bounded wait, so pause and stop are still seen if the decoder stalls
+            if (!decoder.getFrame(grabbedFrame, 100))
+                continue;
+            grabbedFrame.stamp(StageCaptured);
+            scaleToWorkingSize(grabbedFrame);
         }
-        else if(inputMode == INPUT_IMAGE)
+        else if (mode == INPUT_CAMERA)
         {
-            inputMutex.unlock();
-            msleep(50);
+            // Capture a frame straight into a recycled buffer
+            cv::Mat &buffer = framePool.acquire();
+            capMutex.lock();
+            cap >> buffer;
+            capMutex.unlock();
+            grabbedFrame = Frame(buffer, true);
+            grabbedFrame.stamp(StageCaptured);
+            scaleToWorkingSize(grabbedFrame);
+        }
+        else
+            grabbedFrame.stamp(StageCaptured);
+
+        if (grabbedFrame.empty())
+        {
+            if (mode == INPUT_CAMERA)
+                msleep(10);
+            continue;
+        }
+        grabbedFrame.setSequence(sequence, source);
+        sequence += 1;
+
+        if (mode == INPUT_VIDEO)
+        {
+            // Present the frame when it is due
+            capMutex.lock();
+            qint64 wait = pacer.usecsUntilDue();
+            capMutex.unlock();
+            if (wait > 0)
+                usleep(wait);
+        }
+
+        // add the frame to the buffer (shared, not copied) and hand it over,
+        // so that nothing here keeps a reference
+        grabbedFrame.stamp(StageEnqueued);
+        inputBuffer->passFrame(grabbedFrame);
+
+        if (mode == INPUT_VIDEO)
+        {
+            // The decoder loops the file by itself
+            capMutex.lock();
+            pacer.frameShown();
+            capMutex.unlock();
         }
-        inputMutex.unlock();
     }
 }
 
 
+void CaptureThread::setInputMode(int m)
+{
+    QMutexLocker locker(&inputMutex);
+    inputMode = m;
+    sourceId += 1;
+    // The image loop may be waiting for a still image that is not coming
+    stillImageChanged.wakeAll();
+}
+
+void CaptureThread::scaleToWorkingSize(Frame &frame)
+{
+    cv::Size size = getWorkingSize();
+    // Native resolution, or already the right size: nothing to do
+    if (size.area() == 0 || frame.empty() || frame.mat().size() == size)
+        return;
+    cv::Mat &scaled = framePool.acquire();
+    cv::resize(frame.mat(), scaled, size, 0, 0, cv::INTER_AREA);
+    FrameInfo info = frame.info();
+    frame = Frame(scaled, true);
+    frame.setInfo(info);
+}
+
 void CaptureThread::disconnectCamera()
 {
+    decoder.close();
     if(cap.isOpened())
     {
         cap.release();
     }
 }
 
+void CaptureThread::pause()
+{
+    QMutexLocker locker(&stateMutex);
+    paused = true;
+}
+
+void CaptureThread::play()
+{
+    QMutexLocker locker(&stateMutex);
+    paused = false;
+    stateChanged.wakeAll();
+}
+
 void CaptureThread::stopCaptureThread()
 {
-    stoppedMutex.lock();
+    stateMutex.lock();
     stopped=true;
-    stoppedMutex.unlock();
+    stateChanged.wakeAll();
+    stateMutex.unlock();
+
+    // Interrupt whichever wait the thread is in
+    inputMutex.lock();
+    stillImageChanged.wakeAll();
+    inputMutex.unlock();
+    inputBuffer->setAborted(true);
 }
 
 bool CaptureThread::readVideo(QString fn)
@@ -98,7 +203,16 @@ bool CaptureThread::readVideo(QString fn)
     capMutex.lock();
     if (cap.isOpened())
         cap.release();
-        res = cap.open(fn.toStdString());
+    capMutex.unlock();
+
+    res = decoder.open(fn);
+    // The rate is read once; a bad value falls back to DEFAULT_VIDEO_FPS
+    capMutex.lock();
+    if (res)
+    {
+        pacer.setFps(decoder.getFps());
+        pacer.reset();
+    }
     capMutex.unlock();
 
     return res;
@@ -108,13 +222,22 @@ bool CaptureThread::readImage(QString fn)
 {
     setInputMode(INPUT_IMAGE);
 
+    decoder.close();
     capMutex.lock();
     if (cap.isOpened())
         cap.release();
     capMutex.unlock();
 
-    grabbedFrame = cv::imread(fn.toStdString());
-    cv::resize(grabbedFrame, grabbedFrame, cv::Size(332, 232));
+    cv::Mat image = cv::imread(fn.toStdString());
+    cv::Size size = getWorkingSize();
+    if (size.area() != 0 && !image.empty() && image.size() != size)
+        cv::resize(image, image, size, 0, 0, cv::INTER_AREA);
+    // The still image is shared by every frame sent, never copied
+    inputMutex.lock();
+    stillImage = Frame(image);
+    stillImagePending = true;
+    stillImageChanged.wakeAll();
+    inputMutex.unlock();
 
     return true;
 }
@@ -124,6 +247,7 @@ bool CaptureThread::connectToCamera(int c)
     setInputMode(INPUT_CAMERA);
     bool res = false;
 
+    decoder.close();
     capMutex.lock();
     if (cap.isOpened())
         cap.release();
@@ -5,6 +5,9 @@
 #include <QtGui>
 #include "opencv/highgui.h"
 #include "imagebuffer.h"
+#include "frame.h"
+#include "framepacer.h"
+#include "videodecoder.h"
 #include "config.h"
 
 class CaptureThread : public QThread
@@ -14,14 +17,22 @@ class CaptureThread : public QThread
 public:
     CaptureThread(ImageBuffer *buffer);
 
-    void setInputMode(int m)    { QMutexLocker locker(&inputMutex); inputMode = m; }
+    // Called whenever an input is opened; starts a new source
+    void setInputMode(int m);
+    // Size frames are processed at; an empty size keeps the native one
+    void setWorkingSize(cv::Size s) { QMutexLocker locker(&inputMutex); workingSize = s; }
+    cv::Size getWorkingSize()   { QMutexLocker locker(&inputMutex); return workingSize; }
     int  getInputMode()         { return inputMode; }
-    bool isCameraConnected()    { return cap.isOpened(); }
-    int  getInputSourceWidth()  { return cap.get(CV_CAP_PROP_FRAME_WIDTH); }
-    int  getInputSourceHeight() { return cap.get(CV_CAP_PROP_FRAME_HEIGHT); }
-    void pause()                { QMutexLocker locker(&pauseMutex); paused = true; }
-    void play()                 { QMutexLocker locker(&pauseMutex); paused = false; }
-    bool isPaused()             { return paused; }
+    bool isCameraConnected()    { return cap.isOpened() || decoder.isOpened(); }
+    int  getInputSourceWidth()  { return decoder.isOpened() ? decoder.getWidth() : cap.get(CV_CAP_PROP_FRAME_WIDTH); }
+    int  getInputSourceHeight() { return decoder.isOpened() ? decoder.getHeight() : cap.get(CV_CAP_PROP_FRAME_HEIGHT); }
+    void pause();
+    void play();
+    bool isPaused()             { QMutexLocker locker(&stateMutex); return paused; }
+    // Decode video as fast as possible instead of at its frame rate
+    void setFreeRun(bool f)     { QMutexLocker locker(&capMutex); pacer.setFreeRun(f); pacer.reset(); }
+    bool isFreeRun()            { QMutexLocker locker(&capMutex); return pacer.isFreeRun(); }
+    int  getSkippedFrames()     { QMutexLocker locker(&capMutex); return pacer.getSkippedFrames(); }
 
     bool readVideo(QString fn);
     bool readImage(QString fn);
@@ -31,16 +42,34 @@ public:
 
 private:
     ImageBuffer *inputBuffer;
+    void scaleToWorkingSize(Frame &frame);
+    bool isStopped()            { QMutexLocker locker(&stateMutex); return stopped; }
+
     cv::VideoCapture cap;
-    cv::Mat grabbedFrame;
-    QMutex stoppedMutex;
+    // Video files are decoded ahead on their own thread
+    VideoDecoder decoder;
+    Frame grabbedFrame;
+    // Still image; only sent when it was loaded or refreshed
+    Frame stillImage;
+    bool  stillImagePending;
+    QWaitCondition stillImageChanged;
+    FramePool framePool;
+    FramePacer pacer;
     QMutex inputMutex;
     QMutex capMutex;
-    QMutex pauseMutex;
+    // Guards paused and stopped; stateChanged is signalled when either changes
+    QMutex stateMutex;
+    QWaitCondition stateChanged;
 
-    volatile bool stopped;
+    bool stopped;
     bool paused;
     int inputMode;
+    // Frame numbering: sourceId is bumped by the GUI side, source and
+    // sequence belong to the capture loop
+    int sourceId;
+    int source;
+    qint64 sequence;
+    cv::Size workingSize;
 protected:
     void run();
 };
@@ -11,8 +11,67 @@
 #define DEFAULT_IMAGE_BUFFER_SIZE 1
 // Drop frame if image/frame buffer is full
 #define DEFAULT_DROP_FRAMES false
+// What a producer does when an image buffer is full (ImageBuffer::Policy)
+#define DEFAULT_BUFFER_POLICY (DEFAULT_DROP_FRAMES ? ImageBuffer::DropNewest : ImageBuffer::Block)
+// Longest a producer blocks on a full buffer, in ms (-1: no limit)
+#define DEFAULT_BUFFER_TIMEOUT -1
+// Latest frame wins on camera input: buffers replace unread frames
+#define DEFAULT_CAMERA_MAILBOX true
+// Spins before a thread parks on an empty/full image buffer
+#define DEFAULT_BUFFER_SPIN_COUNT 64
+// Processing resolution; 0x0 keeps the native camera/video resolution
+#define DEFAULT_WORKING_WIDTH  0
+#define DEFAULT_WORKING_HEIGHT 0
+// Size of the input/output labels in the UI
+#define DEFAULT_DISPLAY_WIDTH  332
+#define DEFAULT_DISPLAY_HEIGHT 232
+// Frame rate used when a video file does not report a valid one
+#define DEFAULT_VIDEO_FPS 25
+// Decode video as fast as possible instead of at its frame rate
+#define DEFAULT_FREE_RUN false
+// Frames a video may skip to catch up before its schedule is restarted
+#define DEFAULT_MAX_FRAME_SKIP 30
+// Video frames decoded ahead of playback
+#define DEFAULT_PREFETCH_FRAMES 8
+// Frames in the rolling latency window, and how often the processing
+// thread logs it (in frames, 0: only when stopping). The log is written
+// from the thread finishing the frame; for regular reports poll
+// ProcessingThread::getLatencyReport() instead.
+#define DEFAULT_LATENCY_WINDOW 512
+#define DEFAULT_LATENCY_REPORT_INTERVAL 0
+// Filter stages are spread over this many threads, with at most this many
+// frames between capture and display (1 for either: one thread)
+#define DEFAULT_PIPELINE_SEGMENTS 4
+#define DEFAULT_FRAMES_IN_FLIGHT 4
+// Frames between checks whether the measured stage times call for another
+// split of the stages over those threads (the first check ends the warm-up)
+#define DEFAULT_REBALANCE_INTERVAL 32
+// Neighbourhood filters run on row bands of about this many bytes, so the
+// intermediate images of a band stay in L2 (0: whole frames, one thread)
+#define DEFAULT_TILE_BYTES 65536
+// Detection overlays that follow each other run their detectors in parallel
+// on the image as it was before any overlay; otherwise each one sees what
+// the ones before it drew
+#define DEFAULT_CONCURRENT_DETECTORS false
+// Feature detection on video: frames between full detections, tracking
+// the keypoints in between (0: no tracking), and the fewest tracked
+// keypoints before detecting again
+#define DEFAULT_FEATURE_TRACK_INTERVAL 0
+#define DEFAULT_FEATURE_TRACK_MIN_POINTS 20
+// Seed of the salt and pepper noise; fixed for reproducible benchmark runs
+// (0: seeded from the clock)
+#define DEFAULT_NOISE_SEED 0
+// Harris corners drawn and reported per frame, strongest first (0: all)
+#define DEFAULT_HARRIS_MAX_CORNERS 0
+// Gaussian blurs at least this wide (in pixels, derived from sigma when no
+// size is given) run as three stacked box filters, whose cost does not
+// grow with the size, if boxGaussianFits(); the mean difference to the
+// exact blur stays under a grey level. In benchmarks/gaussianbench the
+// boxes were faster at every size they fit from 9 up. (0: always exact)
+#define DEFAULT_BLUR_BOX_SIZE 9
 // Thread priorities
 #define DEFAULT_CAP_THREAD_PRIO QThread::NormalPriority
+#define DEFAULT_DECODE_THREAD_PRIO QThread::NormalPriority
 #define DEFAULT_PROC_THREAD_PRIO QThread::HighPriority
 
 // Input mode
@@ -8,16 +8,13 @@
 Controller::Controller()
 {
     imageBufferSize = DEFAULT_IMAGE_BUFFER_SIZE;
-    inputBuffer = new ImageBuffer(this, imageBufferSize);
-    outputBuffer = new ImageBuffer(this, imageBufferSize);
+    inputBuffer = new ImageBuffer(this, imageBufferSize, DEFAULT_DROP_FRAMES);
 
+    // Capture hands frames straight to processing; the GUI thread only
+    // receives the images to display
     captureThread    = new CaptureThread(inputBuffer);
-    processingThread = new ProcessingThread(outputBuffer);
-    connect(inputBuffer, SIGNAL(newFrame()), this, SLOT(processFrame()));
-
-    logo = cv::Mat();
-    logoROI = QRect();
-    logoOrigen = QPoint();
+    processingThread = new ProcessingThread(inputBuffer);
+    connect(processingThread, SIGNAL(newInputFrame(QImage)), this, SIGNAL(newInputFrame(QImage)));
 }
 
 Controller::~Controller()
@@ -28,6 +25,7 @@ bool Controller::readImage(QString filename)
 {
     bool res = false;
     inputMode = INPUT_IMAGE;
+    setBufferPolicy(DEFAULT_BUFFER_POLICY);
 
     if (captureThread->isRunning())
     {
@@ -44,10 +42,7 @@ bool Controller::readImage(QString filename)
             processingThread->play();
         }
         else
-        {
-            captureThread->start(DEFAULT_CAP_THREAD_PRIO);
-            processingThread->start(DEFAULT_PROC_THREAD_PRIO);
-        }
+            startThreads();
     }
 
     return res;
@@ -57,6 +52,7 @@ bool Controller::readVideo(QString filename)
 {
     bool res = false;
     inputMode = INPUT_VIDEO;
+    setBufferPolicy(DEFAULT_BUFFER_POLICY);
 
     if (captureThread->isRunning())
     {
@@ -73,10 +69,7 @@ bool Controller::readVideo(QString filename)
             processingThread->play();
         }
         else
-        {
-            captureThread->start(DEFAULT_CAP_THREAD_PRIO);
-            processingThread->start(DEFAULT_PROC_THREAD_PRIO);
-        }
+            startThreads();
     }
 
     return res;
@@ -86,6 +79,8 @@ bool Controller::connectToCamera()
 {
     bool isOpened    = false;
     inputMode = INPUT_CAMERA;
+    // only the newest camera frame matters
+    setBufferPolicy(DEFAULT_CAMERA_MAILBOX ? ImageBuffer::Mailbox : DEFAULT_BUFFER_POLICY);
 
     if (captureThread->isRunning())
     {
@@ -102,34 +97,32 @@ bool Controller::connectToCamera()
             processingThread->play();
         }
         else
-        {
-            captureThread->start(DEFAULT_CAP_THREAD_PRIO);
-            processingThread->start(DEFAULT_PROC_THREAD_PRIO);
-        }
+            startThreads();
     }
 
     return isOpened;
 }
 
+void Controller::startThreads()
+{
+    // A previous stop left the buffer aborted
+    inputBuffer->setAborted(false);
+    captureThread->start(DEFAULT_CAP_THREAD_PRIO);
+    processingThread->start(DEFAULT_PROC_THREAD_PRIO);
+}
+
 
 void Controller::stopThreads()
 {
+    // Stopping wakes the threads from any wait (pause, empty or full
+    // buffers), so they finish within a frame
     captureThread->stopCaptureThread();
-
-    // Take one frame off a FULL queue to allow the capture thread to finish
-    if(inputBuffer->getSizeOfImageBuffer() == imageBufferSize)
-        inputBuffer->getFrame();
-
-    if (!captureThread->wait(2000))
-    {
-        captureThread->terminate();
-    }
-
     processingThread->stopProcessingThread();
-    if (!processingThread->wait(2000))
-    {
-        processingThread->terminate();
-    }
+    captureThread->wait();
+    processingThread->wait();
+
+    logBufferStatistics("Input buffer", inputBuffer->getStatistics());
+    qDebug() << "Pipeline:" << qPrintable(LatencyStats::format(processingThread->getLatencyReport()));
 }
 
 
@@ -143,13 +136,35 @@ void Controller::deleteThreads()
 void Controller::clearImageBuffers()
 {
     inputBuffer->clearBuffer();
-    outputBuffer->clearBuffer();
 }
 
 void Controller::deleteImageBuffers()
 {
     delete inputBuffer;
-    delete outputBuffer;
+}
+
+void Controller::setBufferPolicy(ImageBuffer::Policy policy)
+{
+    inputBuffer->setPolicy(policy, DEFAULT_BUFFER_TIMEOUT);
+}
+
+void Controller::logBufferStatistics(const char *name, const ImageBufferStats &stats)
+{
+    qDebug() << name << ": enqueued" << stats.enqueued
+             << "dropped" << stats.dropped
+             << "overwritten" << stats.overwritten
+             << "high-water" << stats.highWaterMark << "of" << stats.capacity;
+    // Wait histograms, one line per side: "<=2^i us: count"
+    QString producer, consumer;
+    for (int i=0; i<ImageBuffer::WaitBuckets; i+=1)
+    {
+        if (stats.producerWaits[i])
+            producer += QString(" <%1us:%2").arg(1 << i).arg(stats.producerWaits[i]);
+        if (stats.consumerWaits[i])
+            consumer += QString(" <%1us:%2").arg(1 << i).arg(stats.consumerWaits[i]);
+    }
+    qDebug() << "  producer waits" << producer;
+    qDebug() << "  consumer waits" << consumer;
 }
 
 void Controller::setInputMode(int mode)
@@ -164,38 +179,16 @@ int Controller::getInputMode()
 
 bool Controller::loadLogo(QString filename)
 {
-    logo = cv::imread(filename.toStdString());
+    processingThread->setLogo(cv::imread(filename.toStdString()));
     return true;
 }
 
 void Controller::setLogoROI(QRect roi, QPoint origen)
 {
-    logoROI = roi;
-    logoOrigen = origen;
+    processingThread->setLogoROI(roi, origen);
 }
 
-void Controller::processFrame()
+void Controller::setWorkingSize(int width, int height)
 {
-    // get the frame from inputbuffer
-    cv::Mat frame = inputBuffer->getFrame();
-
-    // check if it's necessary to insert a logo
-    if (processingThread->getFilter(ImageProcessingFlags::ShowLogo) &&
-        !logo.empty() &&
-        !logoROI.isEmpty())
-    {
-        cv::Mat logoResized;
-        cv::Mat imageROI = frame(cv::Rect(
-                                     logoOrigen.x(),
-                                     logoOrigen.y(),
-                                     logoROI.width(),
-                                     logoROI.height()));
-        cv::resize(logo, logoResized, imageROI.size());
-        cv::addWeighted(imageROI, 1.0, logoResized, 0.3, 0., imageROI);
-    }
-
-    // add the new frame to the outputbuffer, so the processingThread can take it
-    outputBuffer->addFrame(frame);
-    // send signal to update the inputlabel in the UI
-    emit newInputFrame(MatToQImage(frame));
+    captureThread->setWorkingSize(cv::Size(width, height));
 }
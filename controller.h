@@ -5,6 +5,8 @@
 #include "imagebuffer.h"
 #include "processingthread.h"
 #include "structures.h"
+#include "frame.h"
+#include "mattoqimage.h"
 #include <QtGui>
 #include <opencv/highgui.h>
 
@@ -18,7 +20,6 @@ public:
     ~Controller();
 
     ImageBuffer      *inputBuffer;
-    ImageBuffer      *outputBuffer;
     ProcessingThread *processingThread;
     CaptureThread    *captureThread;
 
@@ -29,23 +30,26 @@ public:
     void deleteImageBuffers();
     void setInputMode(int);
     int  getInputMode();
+    void setBufferPolicy(ImageBuffer::Policy);
+    // Processing resolution; 0x0 processes at the native resolution
+    void setWorkingSize(int width, int height);
     bool readVideo(QString);
     bool loadLogo(QString);
     bool readImage(QString);
 
 public slots:
-    void processFrame();
     void setLogoROI(QRect, QPoint);
 
 signals:
+    // Forwarded from the processing thread
     void newInputFrame(QImage);
 
 private:
+    void startThreads();
+    void logBufferStatistics(const char *name, const ImageBufferStats &stats);
+
     int imageBufferSize;
     int inputMode;
-    cv::Mat logo;
-    QRect logoROI;
-    QPoint logoOrigen;
 };
 
 #endif // CONTROLLER_H
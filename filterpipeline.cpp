@@ -0,0 +1,389 @@
+#include "filterpipeline.h"
+#include <QAtomicInt>
+#include "parallel.h"
+#include "config.h"
+
+// Order in which enabled filters are applied
+static const int chainOrder[] = {
+    ImageProcessingFlags::ConvertColorspace,
+    ImageProcessingFlags::SaltPepperNoise,
+    ImageProcessingFlags::Dilate,
+    ImageProcessingFlags::Erode,
+    ImageProcessingFlags::Open,
+    ImageProcessingFlags::Close,
+    ImageProcessingFlags::Blur,
+    ImageProcessingFlags::Sobel,
+    ImageProcessingFlags::Laplacian,
+    ImageProcessingFlags::SharpByKernel,
+    ImageProcessingFlags::EdgeDetection,
+    ImageProcessingFlags::LinesHough,
+    ImageProcessingFlags::CirclesHough,
+    ImageProcessingFlags::Countours,
+    ImageProcessingFlags::BoundingBox,
+    ImageProcessingFlags::enclosingCircle,
+    ImageProcessingFlags::harris,
+    ImageProcessingFlags::FAST,
+    ImageProcessingFlags::SURF,
+    ImageProcessingFlags::SIFT,
+    ImageProcessingFlags::EqualizeHistogram,
+    ImageProcessingFlags::ComputeHistogram
+};
+static const int chainLength = sizeof(chainOrder) / sizeof(chainOrder[0]);
+// one past the last filter index
+static const int filterCount = ImageProcessingFlags::SIFT + 1;
+// Ids of source images, the frame part of the ImageCache keys
+static QAtomicInt sourceIds;
+
+namespace {
+
+// Detectors of consecutive overlays; part k is stage k
+struct DetectJob : public ParallelTask {
+    const QVector<FilterStage*> *stages;
+    ImageCache *cache;
+
+    void run(int k)
+    {
+        FilterStage *stage = (*stages)[k];
+        int64 start = cv::getTickCount();
+        stage->detect(*cache);
+        stage->addTiming((cv::getTickCount() - start) * 1000000 / (qint64) cv::getTickFrequency());
+    }
+};
+
+}
+
+FilterPipeline::FilterPipeline()
+    : stages(filterCount, 0)
+    , concurrentDetectors(DEFAULT_CONCURRENT_DETECTORS)
+{
+}
+
+FilterPipeline::~FilterPipeline()
+{
+    for (int i=0; i<stages.size(); i+=1)
+        delete stages[i];
+}
+
+FilterStage* FilterPipeline::createStage(int filter)
+{
+    switch (filter)
+    {
+    case ImageProcessingFlags::ConvertColorspace: return new ConvertColorStage();
+    case ImageProcessingFlags::SaltPepperNoise:   return new SaltPepperStage();
+    case ImageProcessingFlags::Dilate:            return new MorphologyStage();
+    case ImageProcessingFlags::Blur:              return new GaussianBlurStage();
+    case ImageProcessingFlags::Sobel:             return new SobelStage();
+    case ImageProcessingFlags::Laplacian:         return new LaplacianStage();
+    case ImageProcessingFlags::SharpByKernel:     return new SharpenStage();
+    case ImageProcessingFlags::EdgeDetection:     return new CannyStage();
+    case ImageProcessingFlags::LinesHough:        return new LinesHoughStage();
+    case ImageProcessingFlags::CirclesHough:      return new CirclesHoughStage();
+    case ImageProcessingFlags::Countours:
+    case ImageProcessingFlags::BoundingBox:
+    case ImageProcessingFlags::enclosingCircle:   return new ContourStage(filter);
+    case ImageProcessingFlags::harris:            return new HarrisStage();
+    case ImageProcessingFlags::FAST:
+    case ImageProcessingFlags::SURF:
+    case ImageProcessingFlags::SIFT:              return new FeatureStage(filter);
+    case ImageProcessingFlags::EqualizeHistogram: return new EqualizeStage();
+    case ImageProcessingFlags::ComputeHistogram:  return new HistogramStage();
+    }
+    // ShowLogo is applied to the input frame, not here
+    return 0;
+}
+
+void FilterPipeline::build(const ImageProcessingFlags &flags, const ImageProcessingSettings &settings)
+{
+    active.clear();
+    for (int i=0; i<chainLength; i+=1)
+    {
+        int filter = chainOrder[i];
+        if (filter == ImageProcessingFlags::Erode || filter == ImageProcessingFlags::Open
+                || filter == ImageProcessingFlags::Close)
+            continue; // planned by the morphology stage, in the slot of Dilate
+        if (filter == ImageProcessingFlags::Dilate)
+        {
+            addMorphology(flags, settings);
+            continue;
+        }
+        if (filter >= (int) flags.flags.size() || !flags.flags[filter])
+        {
+            // Switched off: keep the stage, not its frame buffers
+            if (stages[filter])
+                stages[filter]->releaseBuffers();
+            continue;
+        }
+        if (!stages[filter])
+            stages[filter] = createStage(filter);
+        stages[filter]->configure(settings);
+        if (!stages[filter]->isIdentity())
+            active.append(stages[filter]);
+    }
+}
+
+void FilterPipeline::addMorphology(const ImageProcessingFlags &flags, const ImageProcessingSettings &settings)
+{
+    FilterStage *&slot = stages[ImageProcessingFlags::Dilate];
+    if (!slot)
+        slot = createStage(ImageProcessingFlags::Dilate);
+    MorphologyStage *stage = static_cast<MorphologyStage*>(slot);
+    stage->setFilters(flags);
+    stage->configure(settings);
+    if (stage->isIdentity())
+        stage->releaseBuffers();
+    else
+        active.append(stage);
+}
+
+PipelineJob::PipelineJob()
+    : isFrame(true)
+    , sourceId(-1)
+    , ticket(0)
+    , record(false)
+{
+}
+
+bool FilterPipeline::isTileable(const FilterStage *stage)
+{
+    return stage->kind() == FilterStage::Transform && stage->radius() >= 0
+        && stage->inputFormat() == FilterStage::AnyFormat;
+}
+
+cv::Mat FilterPipeline::convert(PipelineJob &job, FilterStage::Format format, ImageCache &cache)
+{
+    if (format == FilterStage::Gray8U && job.image.channels() != 1)
+    {
+        // Overlays drew on a copy since the source was taken
+        if (job.image.data != job.source.data)
+            setSource(job);
+        cache.bind(job.source, job.sourceId, job.frame.info());
+        return cache.gray();
+    }
+    return job.image;
+}
+
+void FilterPipeline::begin(PipelineJob &job)
+{
+    job.image   = job.frame.mat();
+    job.isFrame = true;
+    job.histogram.release();
+    job.corners.clear();
+    setSource(job);
+}
+
+void FilterPipeline::setSource(PipelineJob &job)
+{
+    job.source   = job.image;
+    job.sourceId = sourceIds.fetchAndAddRelaxed(1);
+}
+
+void FilterPipeline::writableFrame(PipelineJob &job)
+{
+    // Our own headers on the frame would count as sharing: drop them first
+    job.image.release();
+    job.source.release();
+    job.image  = job.frame.mutableMat();
+    job.source = job.image;
+}
+
+void FilterPipeline::drawOnFrame(PipelineJob &job, ImageCache &cache)
+{
+    // The detectors are done with the cache; its reference would count as
+    // sharing too
+    cache.unbind();
+    writableFrame(job);
+}
+
+bool FilterPipeline::sourceReadAfter(int i) const
+{
+    // Any stage that is not an overlay or analysis takes a new source
+    if (i+1 >= active.size())
+        return false;
+    FilterStage::Kind k = active[i+1]->kind();
+    return k == FilterStage::Overlay || k == FilterStage::Analysis;
+}
+
+void FilterPipeline::run(PipelineJob &job)
+{
+    begin(job);
+    runStages(job, 0, active.size(), cache);
+}
+
+void FilterPipeline::runStages(PipelineJob &job, int first, int last, ImageCache &cache)
+{
+    for (int i=first; i<last; i+=1)
+    {
+        FilterStage *stage = active[i];
+        int64 start = cv::getTickCount();
+        if (isTileable(stage))
+        {
+            // Fuse the neighbourhood stages that follow and run them band
+            // by band, unless the frame fits in a single band anyway
+            int end  = i + 1;
+            int halo = stage->radius();
+            while (end < last && isTileable(active[end]))
+            {
+                halo += active[end]->radius();
+                end  += 1;
+            }
+            if (tiler.worthTiling(job.image, halo))
+            {
+                cv::Mat &out = active[end-1]->outputBuffer();
+                tiler.run(active, i, end, job.image, out);
+                job.image   = out;
+                job.isFrame = false;
+                setSource(job);
+                // The group is timed as a whole; share it out evenly
+                qint64 usecs = (cv::getTickCount() - start) * 1000000 / (qint64) cv::getTickFrequency();
+                for (int k=i; k<end; k+=1)
+                    active[k]->addTiming(usecs / (end - i));
+                i = end - 1;
+                continue;
+            }
+        }
+        switch (stage->kind())
+        {
+        case FilterStage::Transform:
+        {
+            cv::Mat &out = stage->outputBuffer();
+            stage->process(convert(job, stage->inputFormat(), cache), out);
+            job.image   = out;
+            job.isFrame = false;
+            setSource(job);
+        } break;
+        case FilterStage::InPlace:
+        {
+            // Stage buffers are ours; the frame may still be shared
+            if (job.isFrame)
+                writableFrame(job);
+            stage->process(convert(job, stage->inputFormat(), cache), job.image);
+            setSource(job);
+        } break;
+        case FilterStage::Overlay:
+        {
+            if (!concurrentDetectors)
+            {
+                // Sequential: the overlay sees what the ones before it drew
+                cache.bind(job.source, job.sourceId, job.frame.info());
+                stage->detect(cache);
+                if (job.isFrame)
+                    drawOnFrame(job, cache);
+                stage->overlay(job.image);
+                if (stage == stages[ImageProcessingFlags::harris])
+                    job.corners = static_cast<HarrisStage*>(stage)->corners();
+                // New pixels: nothing derived so far applies to them
+                setSource(job);
+                break;
+            }
+            // Concurrent: this overlay and the ones right after it detect at
+            // the same time, all on the image as it was before any of them
+            cache.bind(job.source, job.sourceId, job.frame.info());
+            int end = i + 1;
+            while (end < last && active[end]->kind() == FilterStage::Overlay)
+                end += 1;
+            if (end - i > 1)
+                detectConcurrently(i, end, cache);
+            else
+                stage->detect(cache);
+
+            // Nothing drawn yet: draw on a copy if the stages after these
+            // still read the source, else on the image itself
+            if (job.image.data == job.source.data && sourceReadAfter(end-1))
+            {
+                cv::Mat &canvas = cache.canvas();
+                job.image.copyTo(canvas);
+                job.frame.addCopiedBytes((qint64) canvas.total() * canvas.elemSize());
+                job.image   = canvas;
+                job.isFrame = false;
+            }
+            else if (job.isFrame)
+                drawOnFrame(job, cache);
+            // Composited in chain order, whatever order they finished in
+            for (int k=i; k<end; k+=1)
+            {
+                active[k]->overlay(job.image);
+                if (active[k] == stages[ImageProcessingFlags::harris])
+                    job.corners = static_cast<HarrisStage*>(active[k])->corners();
+            }
+            // Drawn on the source itself: that is the source from now on
+            if (job.image.data == job.source.data)
+                setSource(job);
+            if (end - i > 1)
+            {
+                // the detectors were timed one by one
+                i = end - 1;
+                continue;
+            }
+        } break;
+        case FilterStage::Analysis:
+        {
+            // The current image, or the one before the overlays if the
+            // detectors run concurrently
+            cache.bind(job.source, job.sourceId, job.frame.info());
+            cv::Mat unused;
+            cv::Mat input = (stage->inputFormat() == FilterStage::Gray8U) ? cache.gray() : cache.source();
+            stage->process(input, unused);
+        } break;
+        }
+        stage->addTiming((cv::getTickCount() - start) * 1000000 / (qint64) cv::getTickFrequency());
+
+        if (stage == stages[ImageProcessingFlags::ComputeHistogram])
+            job.histogram = static_cast<HistogramStage*>(stage)->image();
+    }
+}
+
+void FilterPipeline::detectConcurrently(int first, int end, ImageCache &cache)
+{
+    DetectJob job;
+    job.stages = &active;
+    job.cache  = &cache;
+    parallelFor(job, first, end);
+}
+
+double FilterPipeline::stageCost(int i) const
+{
+    // Stages that never ran count as 1 ms
+    double usecs = active[i]->averageUsecs();
+    return (usecs > 0) ? usecs : 1000.0;
+}
+
+QVector<int> FilterPipeline::partition(int n) const
+{
+    QVector<double> cost(active.size());
+    double total = 0;
+    for (int i=0; i<active.size(); i+=1)
+    {
+        cost[i] = stageCost(i);
+        total  += cost[i];
+    }
+
+    QVector<int> bounds;
+    bounds.append(0);
+    double sum = 0;
+    for (int i=0; i<active.size(); i+=1)
+    {
+        sum += cost[i];
+        int segment = bounds.size();
+        int left    = active.size() - (i+1);
+        // Close the range once it reaches its share of the total, or when
+        // the stages left are just enough for the ranges left
+        if (segment < n && left > 0 && (sum >= total * segment / n || left <= n - segment))
+            bounds.append(i+1);
+    }
+    while (bounds.size() <= n)
+        bounds.append(active.size());
+    return bounds;
+}
+
+double FilterPipeline::bottleneck(const QVector<int> &bounds) const
+{
+    double worst = 0;
+    for (int s=0; s+1<bounds.size(); s+=1)
+    {
+        double sum = 0;
+        for (int i=bounds[s]; i<bounds[s+1]; i+=1)
+            sum += stageCost(i);
+        worst = qMax(worst, sum);
+    }
+    return worst;
+}
@@ -0,0 +1,90 @@
+#ifndef FILTERPIPELINE_H
+#define FILTERPIPELINE_H
+
+#include <QVector>
+#include <opencv/cv.h>
+#include "filterstage.h"
+#include "structures.h"
+#include "frame.h"
+#include "tiledexecutor.h"
+#include "imagecache.h"
+
+// A frame on its way through the stages
+struct PipelineJob {
+    PipelineJob();
+
+    Frame   frame;
+    cv::Mat image;      // result so far
+    bool    isFrame;    // image still is the frame's own pixels
+    cv::Mat source;     // what overlays and analysis read; see setConcurrentDetectors()
+    int     sourceId;   // changes with source; keys the ImageCache
+    cv::Mat histogram;  // histogram plot, if that stage ran
+    std::vector<cv::KeyPoint> corners; // Harris corners, if that stage ran
+    qint64  ticket;     // submission order, set by the executor
+    bool    record;     // counts for the latency statistics
+};
+
+// The enabled filters of the processing chain, compiled into a list of
+// stages. build() runs when flags or settings change; run() then only
+// walks that list. Stage objects are kept per filter, so their buffers
+// survive being switched off and on, and a frame goes through the chain
+// without allocations once the buffers have their size.
+class FilterPipeline
+{
+public:
+    FilterPipeline();
+    ~FilterPipeline();
+
+    void build(const ImageProcessingFlags &flags, const ImageProcessingSettings &settings);
+    bool isEmpty() const            { return active.isEmpty(); }
+    int  stageCount() const         { return active.size(); }
+
+    // Runs all stages over job.frame
+    void run(PipelineJob &job);
+    // Prepares a job for runStages()
+    static void begin(PipelineJob &job);
+    // Runs stages [first, last) over the job. The frame is only written
+    // (copied first if shared) when an in-place or overlay stage comes
+    // before any transform. Runs of neighbourhood stages are fused and split into
+    // row bands on the shared thread pool. Overlay and analysis stages share
+    // what they derive from the source through cache; threads running
+    // different ranges at the same time each pass their own.
+    void runStages(PipelineJob &job, int first, int last, ImageCache &cache);
+    // Splits the stages into up to n consecutive ranges of about the same
+    // measured cost; range i is [bounds[i], bounds[i+1])
+    QVector<int> partition(int n) const;
+    // Cost of the slowest range of such a split, from the measured times
+    double bottleneck(const QVector<int> &bounds) const;
+    // Band size of the tiled stages; 0 runs them on whole frames
+    void setTileBytes(int b)        { tiler.setTileBytes(b); }
+    // Consecutive overlays detect in parallel on the shared thread pool
+    // and draw afterwards, and overlays and analysis read the image as it
+    // was before any overlay. Otherwise one detects and draws after the
+    // other, and each reads the image with the earlier overlays on it.
+    // Only call while nothing runs.
+    void setConcurrentDetectors(bool c) { concurrentDetectors = c; }
+
+private:
+    static FilterStage* createStage(int filter);
+    // Dilate, Erode, Open and Close run as one stage
+    void addMorphology(const ImageProcessingFlags &flags, const ImageProcessingSettings &settings);
+    static bool isTileable(const FilterStage *stage);
+    static void setSource(PipelineJob &job);
+    // Makes job.image the frame's own pixels to write on, copying them
+    // (and counting the copy) only if the frame is shared
+    static void writableFrame(PipelineJob &job);
+    // writableFrame() for an overlay, once it has detected
+    static void drawOnFrame(PipelineJob &job, ImageCache &cache);
+    bool sourceReadAfter(int i) const;
+    double stageCost(int i) const;
+    void detectConcurrently(int first, int end, ImageCache &cache);
+    static cv::Mat convert(PipelineJob &job, FilterStage::Format format, ImageCache &cache);
+
+    QVector<FilterStage*> stages;   // indexed by ImageProcessingFlags::filters
+    QVector<FilterStage*> active;   // enabled stages in chain order
+    ImageCache cache;               // for run()
+    TiledExecutor tiler;
+    bool concurrentDetectors;
+};
+
+#endif // FILTERPIPELINE_H
@@ -0,0 +1,866 @@
+#include "filterstage.h"
+#include <QtCore>
+#include <opencv2/nonfree/nonfree.hpp>
+#include <algorithm>
+#include "parallel.h"
+#include "fusedkernels.h"
+#include "boxgaussian.h"
+#include "morphology.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define PI 3.14159265359
+
+FilterStage::FilterStage()
+    : average(0)
+{
+}
+
+FilterStage::~FilterStage()
+{
+}
+
+void FilterStage::addTiming(qint64 usecs)
+{
+    // Exponential average over roughly the last 8 frames; never 0 again
+    // once timed. Only one thread runs a stage at a time, but others read
+    // the average to rebalance the pipeline.
+    int old  = loadAcquire(average);
+    int next = (old == 0) ? (int) usecs : old + (int) ((usecs - old) / 8);
+    average.fetchAndStoreOrdered(qMax(next, 1));
+}
+
+/////////////////////////////////
+// Colour space and noise      //
+/////////////////////////////////
+
+ConvertColorStage::ConvertColorStage()
+    : code(-1)
+{
+}
+
+void ConvertColorStage::configure(const ImageProcessingSettings &s)
+{
+    switch (s.colorSpace)
+    {
+    case 0: code = CV_RGB2GRAY; break; // Gray
+    case 1: code = CV_RGB2HSV;  break; // HSV
+    case 3: code = CV_RGB2Lab;  break; // Lab
+    default: code = -1;
+    }
+}
+
+int ConvertColorStage::radius() const
+{
+    return 0;
+}
+
+void ConvertColorStage::processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &) const
+{
+    cv::cvtColor(src, dst, code);
+}
+
+// Noise pixels per band before it pays to fill bands in parallel
+#define NOISE_PER_BAND 16384
+// Random numbers drawn at a time
+#define NOISE_BLOCK 64
+
+// splitmix64: the state is a counter and every output a hash of it, so
+// any number of independent streams can be started from (seed, stream)
+static inline quint64 mix64(quint64 z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline quint64 nextRandom(quint64 &state)
+{
+    state += 0x9E3779B97F4A7C15ULL;
+    return mix64(state);
+}
+
+namespace {
+
+// One frame of noise; part b is row band b
+struct NoiseJob : public ParallelTask {
+    const SaltPepperStage *stage;
+    cv::Mat dst;
+    int bands;
+    int density;
+    quint64 frame;
+
+    void run(int b)
+    {
+        // Every band gets its share of the pixels, rounded so they add up
+        int y0 = (qint64) dst.rows * b / bands;
+        int y1 = (qint64) dst.rows * (b+1) / bands;
+        int count = (qint64) density * y1 / dst.rows - (qint64) density * y0 / dst.rows;
+        stage->addNoise(dst, y0, y1, count, (frame << 16) + b);
+    }
+};
+
+}
+
+SaltPepperStage::SaltPepperStage()
+    : density(0)
+    , seed(-1)
+    , base(0)
+    , frame(0)
+{
+}
+
+void SaltPepperStage::configure(const ImageProcessingSettings &s)
+{
+    density = s.saltPepperNoiseDensity;
+    if (s.saltPepperSeed == seed)
+        return;
+    // A new seed starts the run over, so it repeats from the first frame
+    seed  = s.saltPepperSeed;
+    base  = (seed != 0) ? (quint64) seed : (quint64) cv::getTickCount();
+    frame = 0;
+}
+
+void SaltPepperStage::process(const cv::Mat &, cv::Mat &dst)
+{
+    if (dst.empty() || (dst.channels() != 1 && dst.channels() != 3))
+        return;
+    NoiseJob job;
+    job.stage   = this;
+    job.dst     = dst;
+    job.bands   = qBound(1, density / NOISE_PER_BAND, qMin(QThread::idealThreadCount(), dst.rows));
+    job.density = density;
+    job.frame   = frame;
+    frame += 1;
+    if (job.bands == 1)
+        job.run(0);
+    else
+        parallelFor(job, 0, job.bands);
+}
+
+void SaltPepperStage::addNoise(cv::Mat &dst, int y0, int y1, int count, quint64 stream) const
+{
+    quint64 state = mix64(base ^ mix64(stream));
+    quint64 rows  = y1 - y0;
+    quint64 cols  = dst.cols;
+    bool color = dst.channels() == 3;
+    quint64 r[NOISE_BLOCK];
+
+    for (int done=0; done<count; done+=NOISE_BLOCK)
+    {
+        int n = qMin(count - done, (int) NOISE_BLOCK);
+        for (int k=0; k<n; k+=1)
+            r[k] = nextRandom(state);
+        for (int k=0; k<n; k+=1)
+        {
+            // row from the high 32 bits, column from the next 24 and the
+            // value {black, white} from the low 8, as (rand % 100) > 50 was
+            int m = y0 + (int) (((r[k] >> 32) * rows) >> 32);
+            int c = (int) ((((r[k] >> 8) & 0xFFFFFF) * cols) >> 24);
+            uchar value = ((((r[k] & 0xFF) * 100) >> 8) > 50) ? 255 : 0;
+
+            uchar *p = dst.ptr<uchar>(m);
+            if (color)
+            {
+                p += 3 * c;
+                p[0] = value;
+                p[1] = value;
+                p[2] = value;
+            }
+            else
+                p[c] = value;
+        }
+    }
+}
+
+/////////////////////////////////
+// Morphology and smoothing    //
+/////////////////////////////////
+
+MorphologyStage::MorphologyStage()
+    : dilate(false)
+    , erode(false)
+    , open(false)
+    , close(false)
+{
+}
+
+void MorphologyStage::setFilters(const ImageProcessingFlags &flags)
+{
+    int size = (int) flags.flags.size();
+    dilate = ImageProcessingFlags::Dilate < size && flags.flags[ImageProcessingFlags::Dilate];
+    erode  = ImageProcessingFlags::Erode  < size && flags.flags[ImageProcessingFlags::Erode];
+    open   = ImageProcessingFlags::Open   < size && flags.flags[ImageProcessingFlags::Open];
+    close  = ImageProcessingFlags::Close  < size && flags.flags[ImageProcessingFlags::Close];
+}
+
+void MorphologyStage::addPass(bool max, int r)
+{
+    if (r <= 0)
+        return;
+    // A max after a max is the max over the larger square (the image is a
+    // rectangle, so clipping to it does not change that)
+    if (!passes.isEmpty() && passes.last().dilate == max)
+    {
+        passes.last().radius += r;
+        return;
+    }
+    Pass pass = { max, r };
+    passes.append(pass);
+}
+
+void MorphologyStage::configure(const ImageProcessingSettings &s)
+{
+    passes.clear();
+    if (dilate)
+        addPass(true, s.dilateIterations);
+    if (erode)
+        addPass(false, s.erodeIterations);
+    if (open)
+    {
+        addPass(false, s.openIterations);
+        addPass(true, s.openIterations);
+    }
+    if (close)
+    {
+        addPass(true, s.closeIterations);
+        addPass(false, s.closeIterations);
+    }
+}
+
+int MorphologyStage::radius() const
+{
+    // every pass reaches its radius further
+    int r = 0;
+    for (int i=0; i<passes.size(); i+=1)
+        r += passes[i].radius;
+    return r;
+}
+
+void MorphologyStage::processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &scratch) const
+{
+    // m[0] and m[1] hold the running values, m[2] and m[3] the passes in
+    // between
+    const cv::Mat *in = &src;
+    for (int i=0; i<passes.size(); i+=1)
+    {
+        cv::Mat &out = (i == passes.size() - 1) ? dst : scratch.m[2 + (i & 1)];
+        squareMorphology(*in, out, passes[i].dilate, passes[i].radius, scratch.m[0], scratch.m[1]);
+        in = &out;
+    }
+}
+
+GaussianBlurStage::GaussianBlurStage()
+    : size(1)
+    , sigma(0)
+    , boxes(false)
+{
+}
+
+void GaussianBlurStage::configure(const ImageProcessingSettings &s)
+{
+    size  = s.blurSize;
+    sigma = s.blurSigma;
+    // The exact kernel costs its width per pixel, the boxes a constant
+    boxes = s.blurBoxSize > 0 && gaussianWidth(size, sigma) >= s.blurBoxSize
+         && boxGaussianFits(size, sigma);
+}
+
+int GaussianBlurStage::radius() const
+{
+    if (boxes)
+        return boxGaussianRadius(size, sigma);
+    // no size given: OpenCV derives it from sigma (8-bit rule, wider
+    // than the float one is never needed here)
+    return gaussianWidth(size, sigma) / 2;
+}
+
+void GaussianBlurStage::processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &scratch) const
+{
+    if (boxes)
+        boxGaussian(src, dst, size, sigma, scratch.m);
+    else
+        cv::GaussianBlur(src, dst, cv::Size(size, size), sigma);
+}
+
+/////////////////////////////////
+// Derivatives and edges       //
+/////////////////////////////////
+
+SobelStage::SobelStage()
+    : direction(0)
+    , ksize(1)
+{
+}
+
+int SobelStage::radius() const
+{
+    // ksize 1 and Scharr (-1) still use a 3-pixel neighbourhood
+    return qMax(ksize / 2, 1);
+}
+
+void SobelStage::processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &scratch) const
+{
+    cv::Mat &gradX = scratch.m[0];
+    cv::Mat &gradY = scratch.m[1];
+    cv::Mat &absX  = scratch.m[2];
+    cv::Mat &absY  = scratch.m[3];
+    int scale = 1;
+    int delta = 0;
+    int ddepth = CV_16S;
+
+    // 8-bit images with the small kernels take a single pass
+    if (fusedSobel(src, dst, direction, ksize))
+        return;
+
+    // check the direction
+    switch (direction)
+    {
+    case 0:
+    { // horizontal
+        cv::Sobel( src, gradX, ddepth, 1, 0, ksize, scale, delta, cv::BORDER_DEFAULT );
+        cv::convertScaleAbs( gradX, dst );
+    } break;
+    case 1:
+    { // vertical
+        cv::Sobel( src, gradY, ddepth, 0, 1, ksize, scale, delta, cv::BORDER_DEFAULT );
+        cv::convertScaleAbs( gradY, dst );
+    } break;
+    case 2:
+    { // both directions
+        cv::Sobel( src, gradX, ddepth, 1, 0, ksize, scale, delta, cv::BORDER_DEFAULT );
+        cv::Sobel( src, gradY, ddepth, 0, 1, ksize, scale, delta, cv::BORDER_DEFAULT );
+        cv::convertScaleAbs( gradX, absX );
+        cv::convertScaleAbs( gradY, absY );
+
+        cv::addWeighted( absX, 0.5, absY, 0.5, 0, dst );
+    } break;
+    default:
+        src.copyTo(dst);
+    }
+}
+
+LaplacianStage::LaplacianStage()
+    : ksize(1)
+{
+}
+
+int LaplacianStage::radius() const
+{
+    // ksize 1 is the 3x3 aperture
+    return qMax(ksize / 2, 1);
+}
+
+void LaplacianStage::processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &scratch) const
+{
+    cv::Mat &laplace = scratch.m[0];
+    int scale = 1;
+    int delta = 0;
+    int ddepth = CV_16S;
+
+    if (fusedLaplacian(src, dst, ksize))
+        return;
+
+    cv::Laplacian( src, laplace, ddepth, ksize, scale, delta, cv::BORDER_DEFAULT );
+    cv::convertScaleAbs( laplace, dst );
+}
+
+SharpenStage::SharpenStage()
+    : center(-1)
+{
+}
+
+void SharpenStage::configure(const ImageProcessingSettings &s)
+{
+    // Only rebuilt when the centre changes, not on every settings change
+    if (s.sharpKernelCenter == center)
+        return;
+    center = s.sharpKernelCenter;
+    kernel = cv::Mat(3,3,CV_32F,cv::Scalar(0));// init the kernel with zeros
+    // assigns kernel values
+    kernel.at<float>(1,1)= center;
+    kernel.at<float>(0,1)= -1.0;
+    kernel.at<float>(2,1)= -1.0;
+    kernel.at<float>(1,0)= -1.0;
+    kernel.at<float>(1,2)= -1.0;
+}
+
+int SharpenStage::radius() const
+{
+    return 1;
+}
+
+void SharpenStage::processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &) const
+{
+    // 8-bit images take the integer kernel; the rest go through filter2D
+    if (fusedSharpen(src, dst, center))
+        return;
+    //filter the image
+    cv::filter2D(src, dst, src.depth(), kernel);
+}
+
+CannyStage::CannyStage()
+    : low(100)
+    , high(300)
+{
+}
+
+void CannyStage::process(const cv::Mat &src, cv::Mat &dst)
+{
+    cv::Canny(src, dst, low, high);
+}
+
+/////////////////////////////////
+// Overlays                    //
+/////////////////////////////////
+
+LinesHoughStage::LinesHoughStage()
+    : votes(60)
+{
+}
+
+void LinesHoughStage::detect(ImageCache &cache)
+{
+    // Apply Canny algorithm
+    cv::Mat edges = cache.sourceEdges(125, 350);
+    size = edges.size();
+
+    // Hough tranform for line detection
+    cv::HoughLines(edges, lines, 1, PI/180, votes);
+}
+
+void LinesHoughStage::overlay(cv::Mat &dst)
+{
+    std::vector<cv::Vec2f>::const_iterator it= lines.begin();
+
+    while (it!=lines.end())
+    {
+        float rho = (*it)[0]; // first element is distance rho
+        float theta = (*it)[1]; // second element is angle theta
+        if (theta < PI/4. || theta > 3.*PI/4.)
+        {// ~vertical line
+            // point of intersection of the line with first row
+            cv::Point pt1(rho/cos(theta),0);
+            // point of intersection of the line with last row
+            cv::Point pt2((rho-size.height*sin(theta))/cos(theta),size.height);
+            // draw a white line
+            cv::line( dst, pt1, pt2, cv::Scalar(255), 1);
+        }
+        else
+        { // ~horizontal line
+            // point of intersection of the line with first column
+            cv::Point pt1(0,rho/sin(theta));
+            // point of intersection of the line with last column
+            cv::Point pt2(size.width, (rho-size.width*cos(theta))/sin(theta));
+            // draw a white line
+            cv::line(dst, pt1, pt2, cv::Scalar(255), 1);
+        }
+        ++it;
+    }
+}
+
+CirclesHoughStage::CirclesHoughStage()
+    : minRadius(25)
+    , maxRadius(50)
+{
+}
+
+void CirclesHoughStage::detect(ImageCache &cache)
+{
+    cv::Mat blurred = cache.gaussian(5, 1.5);
+
+    cv::HoughCircles(blurred, circles, CV_HOUGH_GRADIENT,
+                    2,    // accumulator resolution (size of the image / 2)
+                    50,   // minimum distance between two circles
+                    200,  // Canny high threshold
+                    60,   // minimum number of votes
+                    minRadius,
+                    maxRadius);
+}
+
+void CirclesHoughStage::overlay(cv::Mat &dst)
+{
+    std::vector<cv::Vec3f>::const_iterator itc= circles.begin();
+    while (itc!=circles.end())
+    {
+        cv::circle(dst,
+                cv::Point((*itc)[0], (*itc)[1]), // circle centre
+                        (*itc)[2],               // circle radius
+                        cv::Scalar(255),         // color
+                        2);                      // thickness
+        ++itc;
+    }
+}
+
+ContourStage::ContourStage(int f)
+    : filter(f)
+    , low(50)
+    , high(100)
+    , contours(0)
+{
+}
+
+void ContourStage::configure(const ImageProcessingSettings &s)
+{
+    switch (filter)
+    {
+    case ImageProcessingFlags::Countours:
+        low = s.contoursThres;        high = s.contoursThres+30;        break;
+    case ImageProcessingFlags::BoundingBox:
+        low = s.boundingBoxThres;     high = s.boundingBoxThres*2;      break;
+    case ImageProcessingFlags::enclosingCircle:
+        low = s.enclosingCircleThres; high = s.enclosingCircleThres*2;  break;
+    }
+}
+
+void ContourStage::detect(ImageCache &cache)
+{
+    // Blurred gray image, Canny and findContours are shared with the other
+    // contour filters when their thresholds match
+    contours = &cache.contours(low, high);
+}
+
+void ContourStage::overlay(cv::Mat &dst)
+{
+    if (filter == ImageProcessingFlags::Countours)
+    {
+        cv::drawContours(dst,*contours,
+                        -1,                        // draw all contours
+                        cv::Scalar(255, 255, 255), // in white
+                        1);                        // with a thickness of 1
+        return;
+    }
+
+    ImageCache::Contours::const_iterator itc = contours->begin();
+    while (itc != contours->end())
+    {
+        if (filter == ImageProcessingFlags::BoundingBox)
+        {
+            cv::Rect r0 = cv::boundingRect(cv::Mat(*itc));
+            cv::rectangle(dst,r0,cv::Scalar(255, 0, 0), 2);
+        }
+        else
+        {
+            float radius;
+            cv::Point2f center;
+            cv::minEnclosingCircle(cv::Mat(*itc),center,radius);
+            cv::circle(dst, center,
+                    static_cast<int>(radius),
+                    cv::Scalar(0, 255, 0),
+                    2);
+        }
+        ++itc;
+    }
+}
+
+// Whether row[x] is the maximum of its 3x3 neighbourhood; up and down are
+// 0 at the image edges. Of equal neighbours the first in raster order
+// wins, so a plateau gives a single corner.
+static inline bool isPeak(const float *row, const float *up, const float *down, int x, int cols)
+{
+    float v = row[x];
+    for (int nx=x-1; nx<=x+1; nx+=1)
+    {
+        if (nx < 0 || nx >= cols)
+            continue;
+        if (up && !(v > up[nx]))
+            return false;
+        if (down && !(v >= down[nx]))
+            return false;
+    }
+    if (x > 0 && !(v > row[x-1]))
+        return false;
+    if (x+1 < cols && !(v >= row[x+1]))
+        return false;
+    return true;
+}
+
+// Pixels of a float image at or above minValue that are the maximum of
+// their 3x3 neighbourhood, in raster order. With SSE2 the inner pixels are
+// tested four at a time, and the neighbours are only compared where a
+// pixel is over the threshold.
+static void findPeaks(const cv::Mat &image, float minValue, std::vector<cv::KeyPoint> &peaks)
+{
+    peaks.clear();
+    int rows = image.rows;
+    int cols = image.cols;
+    for (int y=0; y<rows; y+=1)
+    {
+        const float *row  = image.ptr<float>(y);
+        const float *up   = (y > 0)      ? image.ptr<float>(y-1) : 0;
+        const float *down = (y+1 < rows) ? image.ptr<float>(y+1) : 0;
+        int x = 0;
+#ifdef __SSE2__
+        if (up && down && cols > 5)
+        {
+            if (row[0] >= minValue && isPeak(row, up, down, 0, cols))
+                peaks.push_back(cv::KeyPoint(cv::Point2f(0, y), 1, -1, row[0]));
+            __m128 limit = _mm_set1_ps(minValue);
+            // x-1 and x+4 have to be inside the row
+            for (x=1; x+4 < cols; x+=4)
+            {
+                __m128 c = _mm_loadu_ps(row + x);
+                __m128 m = _mm_cmpge_ps(c, limit);
+                if (!_mm_movemask_ps(m))
+                    continue;
+                m = _mm_and_ps(m, _mm_cmpgt_ps(c, _mm_loadu_ps(up + x - 1)));
+                m = _mm_and_ps(m, _mm_cmpgt_ps(c, _mm_loadu_ps(up + x)));
+                m = _mm_and_ps(m, _mm_cmpgt_ps(c, _mm_loadu_ps(up + x + 1)));
+                m = _mm_and_ps(m, _mm_cmpgt_ps(c, _mm_loadu_ps(row + x - 1)));
+                m = _mm_and_ps(m, _mm_cmpge_ps(c, _mm_loadu_ps(row + x + 1)));
+                m = _mm_and_ps(m, _mm_cmpge_ps(c, _mm_loadu_ps(down + x - 1)));
+                m = _mm_and_ps(m, _mm_cmpge_ps(c, _mm_loadu_ps(down + x)));
+                m = _mm_and_ps(m, _mm_cmpge_ps(c, _mm_loadu_ps(down + x + 1)));
+                int mask = _mm_movemask_ps(m);
+                for (int i=0; i<4; i+=1)
+                {
+                    if (mask & (1 << i))
+                        peaks.push_back(cv::KeyPoint(cv::Point2f(x + i, y), 1, -1, row[x + i]));
+                }
+            }
+        }
+#endif
+        // Edge rows and the pixels the vector loop left over
+        for (; x<cols; x+=1)
+        {
+            if (row[x] >= minValue && isPeak(row, up, down, x, cols))
+                peaks.push_back(cv::KeyPoint(cv::Point2f(x, y), 1, -1, row[x]));
+        }
+    }
+}
+
+static bool strongerCorner(const cv::KeyPoint &a, const cv::KeyPoint &b)
+{
+    return a.response > b.response;
+}
+
+HarrisStage::HarrisStage()
+    : threshold(150)
+    , maxCorners(0)
+{
+}
+
+void HarrisStage::detect(ImageCache &cache)
+{
+    // Detector parameters
+    int blockSize = 2;
+    int apertureSize = 3;
+    double k = 0.04;
+
+    // Detecting corners
+    cv::cornerHarris(cache.gray(), response, blockSize, apertureSize, k, cv::BORDER_DEFAULT);
+
+    // Normalizing
+    cv::normalize(response, normalized, 0, 255, cv::NORM_MINMAX, CV_32FC1, cv::Mat());
+
+    // (int) v > threshold, as it always was, is v >= threshold + 1
+    findPeaks(normalized, threshold + 1, found);
+    if (maxCorners > 0 && (int) found.size() > maxCorners)
+    {
+        std::partial_sort(found.begin(), found.begin() + maxCorners, found.end(), strongerCorner);
+        found.resize(maxCorners);
+    }
+}
+
+void HarrisStage::overlay(cv::Mat &dst)
+{
+    // Drawing a circle around corners
+    for (size_t i=0; i<found.size(); i+=1)
+        cv::circle(dst, found[i].pt, 5,  cv::Scalar(0, 0 , 255), 2, 8, 0);
+}
+
+// Lucas-Kanade window and pyramid levels of the keypoint tracking
+static const cv::Size trackWindow(21, 21);
+static const int trackLevels = 3;
+
+FeatureStage::FeatureStage(int f)
+    : filter(f)
+    , threshold(0)
+    , edgeThreshold(0)
+    , trackInterval(0)
+    , minTracks(0)
+    , sinceDetection(0)
+    , lastInput(-1)
+    , lastSequence(-1)
+{
+}
+
+void FeatureStage::configure(const ImageProcessingSettings &s)
+{
+    double t = 0, e = 0;
+    switch (filter)
+    {
+    case ImageProcessingFlags::FAST: t = s.fastThreshold; break;
+    case ImageProcessingFlags::SURF: t = s.surfThreshold; break;
+    case ImageProcessingFlags::SIFT: t = s.siftContrastThres; e = s.siftEdgeThres; break;
+    }
+    trackInterval = s.featureTrackInterval;
+    minTracks     = s.featureTrackMinPoints;
+    // Other settings changed: keep the detector we have
+    if (!detector.empty() && t == threshold && e == edgeThreshold)
+        return;
+    threshold     = t;
+    edgeThreshold = e;
+
+    switch (filter)
+    {
+    case ImageProcessingFlags::FAST:
+        // Construction of the Fast feature detector object
+        detector = new cv::FastFeatureDetector(s.fastThreshold); // threshold for detection
+        break;
+    case ImageProcessingFlags::SURF:
+        // Construct the SURF feature detector object
+        detector = new cv::SurfFeatureDetector((double) s.surfThreshold); // threshold
+        break;
+    case ImageProcessingFlags::SIFT:
+        // Construct the SIFT feature detector object
+        detector = new cv::SiftFeatureDetector( s.siftContrastThres,        // feature threshold
+                                                (double) s.siftEdgeThres); // threshold to reduce sens. to lines
+        break;
+    }
+}
+
+void FeatureStage::detect(ImageCache &cache)
+{
+    // The detectors would convert to gray themselves, the same way
+    cv::Mat src = cache.gray(CV_BGR2GRAY);
+    if (trackInterval <= 1)
+    {
+        // feature point detection
+        keypoints.clear();
+        detector->detect(src, keypoints);
+        lastInput = -1;
+        previousPyramid.clear();
+        return;
+    }
+
+    // Keypoints only carry over to a later frame of the same input, at the
+    // same size and type, and counting the frames the buffer dropped on the
+    // way; a still image processed again is detected again. A resize keeps
+    // the input and its sequence numbers.
+    const FrameInfo &frame = cache.frame();
+    qint64 gap = frame.sequence - lastSequence;
+    bool later = frame.sequence >= 0 && frame.source == lastInput && gap > 0
+              && sinceDetection + gap <= trackInterval
+              && !previousPyramid.empty()
+              && previousPyramid[0].size() == src.size()
+              && previousPyramid[0].type() == src.type();
+    lastInput    = frame.source;
+    lastSequence = frame.sequence;
+
+    cv::buildOpticalFlowPyramid(src, pyramid, trackWindow, trackLevels);
+    if (later && track())
+        sinceDetection += (int) gap;
+    else
+    {
+        keypoints.clear();
+        detector->detect(src, keypoints);
+        sinceDetection = 1;
+    }
+    // This pyramid is the previous one of the next frame; the buffers of
+    // the old one are reused for it
+    pyramid.swap(previousPyramid);
+}
+
+bool FeatureStage::track()
+{
+    if (keypoints.empty() || previousPyramid.empty())
+        return false;
+    points.clear();
+    for (size_t i=0; i<keypoints.size(); i+=1)
+        points.push_back(keypoints[i].pt);
+
+    cv::calcOpticalFlowPyrLK(previousPyramid, pyramid, points, tracked, status, errors,
+                             trackWindow, trackLevels);
+
+    // Keep the keypoints that were found again inside the image; scale,
+    // angle and response stay those of the detection
+    cv::Size size = pyramid[0].size();
+    size_t kept = 0;
+    for (size_t i=0; i<keypoints.size(); i+=1)
+    {
+        const cv::Point2f &p = tracked[i];
+        if (!status[i] || p.x < 0 || p.y < 0 || p.x >= size.width || p.y >= size.height)
+            continue;
+        keypoints[kept]    = keypoints[i];
+        keypoints[kept].pt = p;
+        kept += 1;
+    }
+    keypoints.resize(kept);
+    return (int) kept >= minTracks;
+}
+
+void FeatureStage::overlay(cv::Mat &dst)
+{
+    if (filter == ImageProcessingFlags::FAST)
+        cv::drawKeypoints(dst, keypoints, dst, cv::Scalar(255,255,255), cv::DrawMatchesFlags::DRAW_OVER_OUTIMG);
+    else
+        // Draw the keypoints with scale and orientation information
+        cv::drawKeypoints(dst, keypoints, dst, cv::Scalar(255,255,255), cv::DrawMatchesFlags::DRAW_RICH_KEYPOINTS);
+}
+
+/////////////////////////////////
+// Histogram                   //
+/////////////////////////////////
+
+EqualizeStage::EqualizeStage()
+{
+}
+
+void EqualizeStage::process(const cv::Mat &src, cv::Mat &dst)
+{
+    if (src.channels() == 3)
+    {
+        cv::split( src, planes );
+        cv::equalizeHist( planes[0], planes[0] );
+        cv::equalizeHist( planes[1], planes[1] );
+        cv::equalizeHist( planes[2], planes[2] );
+        cv::merge( planes, dst );
+    }
+    else
+    {
+        cv::equalizeHist( src, dst );
+    }
+}
+
+HistogramStage::HistogramStage()
+{
+}
+
+void HistogramStage::process(const cv::Mat &src, cv::Mat &)
+{
+    int histSize = 256;           // number of bins
+    float range [] = {0, 256};    // ranges
+    const float* histRange = { range };
+    bool uniform = true, accumulate = false;
+
+    // compute histogram
+    cv::calcHist(&src,
+                 1,  // using just one image
+                 0,  // using just one layer
+                 cv::Mat(),
+                 hist,
+                 1,
+                 &histSize,
+                 &histRange,
+                 uniform,
+                 accumulate);
+
+    int hist_w = 691; int hist_h =161;
+    cv::Mat &buffer = plots.acquire();
+    buffer.create( hist_h, hist_w, CV_8UC3 );
+    plot = buffer;
+    plot.setTo( cv::Scalar( 255,255,255) );
+    int bin_w = cvRound( (double) hist_w/histSize );
+    cv::normalize(hist, hist, 0, plot.rows, cv::NORM_MINMAX, -1, cv::Mat());
+
+    /// Draw for each channel
+    for( int i = 1; i < histSize; i++ )
+    {
+        cv::line(plot,
+             cv::Point( bin_w*(i-1), hist_h - cvRound(hist.at<float>(i-1)) ),
+             cv::Point( bin_w*(i), hist_h - cvRound(hist.at<float>(i)) ),
+             cv::Scalar( 0, 0, 0), 2, 8, 0  );
+    }
+}
@@ -0,0 +1,331 @@
+#ifndef FILTERSTAGE_H
+#define FILTERSTAGE_H
+
+#include <vector>
+#include <QVector>
+#include "atomicint.h"
+#include <opencv/cv.h>
+#include <opencv2/features2d/features2d.hpp>
+#include <opencv2/video/tracking.hpp>
+#include "structures.h"
+#include "frame.h"
+#include "imagecache.h"
+
+// Temporaries of one stage invocation. Bands of a tiled frame run in
+// parallel, so each brings its own.
+struct StageScratch {
+    cv::Mat m[4];
+};
+
+// Buffers of one band of a tiled group of stages, kept from frame to frame
+struct TileBand {
+    cv::Mat buffers[2];
+    StageScratch scratch;
+};
+
+// One filter of the processing chain. configure() takes the settings when
+// the pipeline is built, so process() only reads members. Temporaries are
+// members too and keep their memory from frame to frame.
+class FilterStage
+{
+public:
+    // How a stage uses the image it is given
+    enum Kind {
+        Transform,  // writes a new image into dst
+        InPlace,    // modifies dst
+        Overlay,    // draws its results into dst
+        Analysis    // only reads src
+    };
+    // Input a stage needs; the pipeline converts when the image differs
+    enum Format {
+        AnyFormat,  // whatever the previous stage produced
+        Gray8U      // single channel, 8 bits
+    };
+
+    FilterStage();
+    virtual ~FilterStage();
+
+    virtual Kind   kind() const         { return Transform; }
+    virtual Format inputFormat() const  { return AnyFormat; }
+    virtual void   configure(const ImageProcessingSettings &) {}
+    // True when the settings make the stage a no-op; it is then left out
+    virtual bool   isIdentity() const   { return false; }
+    // Transform: src -> dst. InPlace: dst holds the image to modify and src
+    // the same image in the input format; src may alias dst, so it is read
+    // completely before dst is written. Analysis: dst is not used, src is
+    // the current image (see FilterPipeline::setConcurrentDetectors()).
+    virtual void   process(const cv::Mat &, cv::Mat &) {}
+    // Overlay stages detect on what they get from the cache and then draw
+    // their results into dst. The cache derives it from the current image,
+    // earlier overlays included, unless the detectors run concurrently:
+    // overlays that follow each other then all detect at the same time on
+    // the image as it was before any of them, and draw in chain order.
+    virtual void   detect(ImageCache &) {}
+    virtual void   overlay(cv::Mat &) {}
+
+    // Local neighbourhood transforms: how many pixels around a pixel its
+    // result depends on, or -1 if the stage cannot run on row bands
+    virtual int    radius() const       { return -1; }
+    // process() for one band; reentrant, so all temporaries are in scratch
+    virtual void   processTile(const cv::Mat &, cv::Mat &, StageScratch &) const {}
+    // Band buffers, used when this stage leads a tiled group
+    QVector<TileBand>& tileBands()      { return bands; }
+
+    // Output buffer of a Transform stage; recycled once nobody else holds it
+    cv::Mat& outputBuffer()             { return outputs.acquire(); }
+    void     releaseBuffers()           { outputs.clear(); }
+
+    // Running average of process() times, used to balance the pipeline
+    double   averageUsecs() const       { return loadAcquire(average); }
+    void     addTiming(qint64 usecs);
+
+protected:
+    StageScratch scratch;
+
+private:
+    FramePool outputs;
+    QAtomicInt average;   // microseconds
+    QVector<TileBand> bands;
+};
+
+class ConvertColorStage : public FilterStage
+{
+public:
+    ConvertColorStage();
+    void configure(const ImageProcessingSettings &s);
+    bool isIdentity() const { return code < 0; }
+    void process(const cv::Mat &src, cv::Mat &dst) { processTile(src, dst, scratch); }
+    int  radius() const;
+    void processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &scratch) const;
+private:
+    int code;
+};
+
+// Sets density random pixels to black or white. Every frame and row band
+// has its own counter-based random stream, so bands are filled in parallel
+// and a fixed seed gives the same noise on every run.
+class SaltPepperStage : public FilterStage
+{
+public:
+    SaltPepperStage();
+    Kind kind() const       { return InPlace; }
+    void configure(const ImageProcessingSettings &s);
+    bool isIdentity() const { return density <= 0; }
+    void process(const cv::Mat &src, cv::Mat &dst);
+    // Noise of band [y0, y1) with count pixels; reentrant
+    void addNoise(cv::Mat &dst, int y0, int y1, int count, quint64 stream) const;
+private:
+    int density;
+    int seed;
+    quint64 base;   // seed of the current run
+    quint64 frame;  // frames since the run started
+};
+
+// Dilate, erode, open and close with the default 3x3 element, whichever
+// are enabled, as one stage. They are planned as a chain of min and max
+// passes over squares (n iterations of the 3x3 element are one square of
+// side 2n+1); passes of the same kind that follow each other are merged.
+class MorphologyStage : public FilterStage
+{
+public:
+    MorphologyStage();
+    // Filters the plan covers; call before configure()
+    void setFilters(const ImageProcessingFlags &flags);
+    void configure(const ImageProcessingSettings &s);
+    bool isIdentity() const { return passes.isEmpty(); }
+    void process(const cv::Mat &src, cv::Mat &dst) { processTile(src, dst, scratch); }
+    int  radius() const;
+    void processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &scratch) const;
+private:
+    struct Pass {
+        bool dilate;    // max, else min
+        int  radius;
+    };
+    void addPass(bool max, int r);
+
+    bool dilate, erode, open, close;
+    QVector<Pass> passes;
+};
+
+class GaussianBlurStage : public FilterStage
+{
+public:
+    GaussianBlurStage();
+    void configure(const ImageProcessingSettings &s);
+    void process(const cv::Mat &src, cv::Mat &dst) { processTile(src, dst, scratch); }
+    int  radius() const;
+    void processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &scratch) const;
+private:
+    int size;
+    double sigma;
+    bool boxes;     // stacked box filters instead of the exact kernel
+};
+
+class SobelStage : public FilterStage
+{
+public:
+    SobelStage();
+    void configure(const ImageProcessingSettings &s) { direction = s.sobelDirection; ksize = s.sobelKernelSize; }
+    void process(const cv::Mat &src, cv::Mat &dst) { processTile(src, dst, scratch); }
+    int  radius() const;
+    void processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &scratch) const;
+private:
+    int direction;
+    int ksize;
+};
+
+class LaplacianStage : public FilterStage
+{
+public:
+    LaplacianStage();
+    void configure(const ImageProcessingSettings &s) { ksize = s.laplacianKernelSize; }
+    void process(const cv::Mat &src, cv::Mat &dst) { processTile(src, dst, scratch); }
+    int  radius() const;
+    void processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &scratch) const;
+private:
+    int ksize;
+};
+
+class SharpenStage : public FilterStage
+{
+public:
+    SharpenStage();
+    void configure(const ImageProcessingSettings &s);
+    void process(const cv::Mat &src, cv::Mat &dst) { processTile(src, dst, scratch); }
+    int  radius() const;
+    void processTile(const cv::Mat &src, cv::Mat &dst, StageScratch &scratch) const;
+private:
+    int center;
+    cv::Mat kernel;
+};
+
+class CannyStage : public FilterStage
+{
+public:
+    CannyStage();
+    void configure(const ImageProcessingSettings &s) { low = s.cannyLowThres; high = s.cannyHighThres; }
+    void process(const cv::Mat &src, cv::Mat &dst);
+private:
+    int low, high;
+};
+
+class LinesHoughStage : public FilterStage
+{
+public:
+    LinesHoughStage();
+    Kind kind() const       { return Overlay; }
+    void configure(const ImageProcessingSettings &s) { votes = s.linesHoughVotes; }
+    void detect(ImageCache &cache);
+    void overlay(cv::Mat &dst);
+private:
+    int votes;
+    cv::Size size;
+    std::vector<cv::Vec2f> lines;
+};
+
+class CirclesHoughStage : public FilterStage
+{
+public:
+    CirclesHoughStage();
+    Kind kind() const       { return Overlay; }
+    void configure(const ImageProcessingSettings &s) { minRadius = s.circlesHoughMin; maxRadius = s.circlesHoughMax; }
+    void detect(ImageCache &cache);
+    void overlay(cv::Mat &dst);
+private:
+    int minRadius, maxRadius;
+    std::vector<cv::Vec3f> circles;
+};
+
+// Contours, their bounding boxes or their enclosing circles
+class ContourStage : public FilterStage
+{
+public:
+    explicit ContourStage(int filter);
+    Kind kind() const       { return Overlay; }
+    void configure(const ImageProcessingSettings &s);
+    void detect(ImageCache &cache);
+    void overlay(cv::Mat &dst);
+private:
+    int filter;
+    int low, high;
+    // Owned by the cache, valid until it is given the next source
+    const ImageCache::Contours *contours;
+};
+
+// Harris corners: local maxima of the normalized response over the
+// threshold, optionally only the strongest ones
+class HarrisStage : public FilterStage
+{
+public:
+    HarrisStage();
+    Kind kind() const       { return Overlay; }
+    void configure(const ImageProcessingSettings &s) { threshold = s.harrisCornerThres; maxCorners = s.harrisMaxCorners; }
+    void detect(ImageCache &cache);
+    void overlay(cv::Mat &dst);
+    // Corners of the last frame; response is the normalized one (0-255)
+    const std::vector<cv::KeyPoint>& corners() const { return found; }
+private:
+    int threshold;
+    int maxCorners;
+    cv::Mat response, normalized;
+    std::vector<cv::KeyPoint> found;
+};
+
+// FAST, SURF and SIFT keypoints. The detector lives as long as its
+// thresholds stay the same. On successive frames of one input it can also
+// run only every few frames, with the keypoints tracked by pyramidal
+// Lucas-Kanade in between; each frame's pyramid is kept for the next one.
+class FeatureStage : public FilterStage
+{
+public:
+    explicit FeatureStage(int filter);
+    Kind kind() const       { return Overlay; }
+    void configure(const ImageProcessingSettings &s);
+    void detect(ImageCache &cache);
+    void overlay(cv::Mat &dst);
+private:
+    int filter;
+    // Thresholds the detector was built with
+    double threshold, edgeThreshold;
+    cv::Ptr<cv::FeatureDetector> detector;
+    std::vector<cv::KeyPoint> keypoints;
+
+    bool track();
+    int trackInterval;
+    int minTracks;
+    int sinceDetection;     // input frames since the detector last ran
+    int lastInput;          // frame the keypoints belong to
+    qint64 lastSequence;
+    std::vector<cv::Mat> pyramid, previousPyramid;
+    std::vector<cv::Point2f> points, tracked;
+    std::vector<uchar> status;
+    std::vector<float> errors;
+};
+
+class EqualizeStage : public FilterStage
+{
+public:
+    EqualizeStage();
+    void process(const cv::Mat &src, cv::Mat &dst);
+private:
+    std::vector<cv::Mat> planes;
+};
+
+// Draws the gray-level histogram into its own image
+class HistogramStage : public FilterStage
+{
+public:
+    HistogramStage();
+    Kind   kind() const        { return Analysis; }
+    Format inputFormat() const { return Gray8U; }
+    void process(const cv::Mat &src, cv::Mat &dst);
+    // Plot of the last frame; the next frame draws into another buffer
+    // while this one is still referenced
+    const cv::Mat& image() const { return plot; }
+private:
+    cv::Mat hist;
+    cv::Mat plot;
+    FramePool plots;
+};
+
+#endif // FILTERSTAGE_H
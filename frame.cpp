@@ -0,0 +1,112 @@
+#include "frame.h"
+#include <QMutex>
+#include <QElapsedTimer>
+
+// Bytes duplicated by Frame::mutableMat(), all frames together
+static QMutex totalCopiedMutex;
+static qint64 totalCopied = 0;
+
+// Frame timestamps are relative to program start; they are only ever
+// compared with each other
+static QElapsedTimer startClock()
+{
+    QElapsedTimer clock;
+    clock.start();
+    return clock;
+}
+static const QElapsedTimer frameClock = startClock();
+
+// Number of references to the pixel data of a Mat. Headers over external
+// data carry no counter and are reported as 0.
+static int refCount(const cv::Mat &m)
+{
+    return m.refcount ? *m.refcount : 0;
+}
+
+FrameInfo::FrameInfo()
+    : sequence(-1)
+    , source(-1)
+{
+    for (int i=0; i<StageCount; i+=1)
+        stamps[i] = 0;
+}
+
+qint64 Frame::clockUsecs()
+{
+    // never 0, which means "not stamped"
+    return frameClock.nsecsElapsed() / 1000 + 1;
+}
+
+Frame::Frame()
+    : pooled(false)
+    , copiedBytes(0)
+{
+}
+
+Frame::Frame(const cv::Mat &m, bool fromPool)
+    : image(m)
+    , pooled(fromPool)
+    , copiedBytes(0)
+{
+}
+
+bool Frame::isShared() const
+{
+    if (image.empty())
+        return false;
+    int refs = refCount(image);
+    // Data we do not own can never be written in place
+    if (refs == 0)
+        return true;
+    return refs > (pooled ? 2 : 1);
+}
+
+cv::Mat& Frame::mutableMat()
+{
+    if (isShared())
+    {
+        qint64 bytes = (qint64) image.total() * image.elemSize();
+        image   = image.clone();
+        pooled  = false;
+        addCopiedBytes(bytes);
+    }
+    return image;
+}
+
+void Frame::addCopiedBytes(qint64 bytes)
+{
+    copiedBytes += bytes;
+    QMutexLocker locker(&totalCopiedMutex);
+    totalCopied += bytes;
+}
+
+void Frame::release()
+{
+    image.release();
+    pooled      = false;
+    copiedBytes = 0;
+    metadata    = FrameInfo();
+}
+
+qint64 Frame::totalBytesCopied()
+{
+    QMutexLocker locker(&totalCopiedMutex);
+    return totalCopied;
+}
+
+FramePool::FramePool()
+{
+}
+
+cv::Mat& FramePool::acquire()
+{
+    // A buffer only referenced by the pool is free
+    for (int i=0; i<buffers.size(); i+=1)
+    {
+        if (refCount(buffers[i]) <= 1)
+            return buffers[i];
+    }
+    // Every buffer is still in flight: grow the pool
+    buffers.append(cv::Mat());
+    return buffers.last();
+}
@@ -0,0 +1,85 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <QVector>
+#include <opencv/cv.h>
+
+// Where a frame is in the pipeline; each stage gets a timestamp
+enum FrameStage {
+    StageCaptured,  // grabbed from the camera, or leaves the video decoder
+    StageEnqueued,  // handed to the input buffer
+    StageDequeued,  // taken by the processing thread
+    StageProcessed, // filter chain done
+    StageDisplayed, // handed to the GUI thread
+    StageCount
+};
+
+// Metadata travelling with a frame. Timestamps are in microseconds of
+// Frame::clockUsecs(), 0 when the stage was not reached.
+struct FrameInfo {
+    FrameInfo();
+
+    qint64 sequence;    // numbered by the capture thread, per source
+    int    source;      // changes whenever another input is opened
+    qint64 stamps[StageCount];
+};
+
+// Refcounted handle to the pixels of one frame. Copying a Frame only bumps
+// the cv::Mat reference count, so frames travel through the buffers without
+// being duplicated. Pixels are treated as immutable while they are shared:
+// mutableMat() clones them first (copy-on-write) and accounts the bytes.
+class Frame
+{
+public:
+    Frame();
+    explicit Frame(const cv::Mat &m, bool fromPool = false);
+
+    const cv::Mat& mat() const { return image; }
+    cv::Mat& mutableMat();
+    bool isShared() const;
+    bool empty() const         { return image.empty(); }
+    void release();
+
+    // Bytes duplicated by copy-on-write on the way to this handle
+    qint64 bytesCopied() const { return copiedBytes; }
+    // Accounts a copy of the image made outside mutableMat()
+    void   addCopiedBytes(qint64 bytes);
+
+    const FrameInfo& info() const       { return metadata; }
+    void   setInfo(const FrameInfo &i)  { metadata = i; }
+    void   setSequence(qint64 seq, int src) { metadata.sequence = seq; metadata.source = src; }
+    qint64 sequence() const             { return metadata.sequence; }
+    int    source() const               { return metadata.source; }
+    // Record that the frame reached a stage now
+    void   stamp(FrameStage s)          { metadata.stamps[s] = clockUsecs(); }
+    qint64 timestamp(FrameStage s) const { return metadata.stamps[s]; }
+    // Monotonic clock shared by all frames
+    static qint64 clockUsecs();
+    // Bytes duplicated by copy-on-write by all frames so far
+    static qint64 totalBytesCopied();
+
+private:
+    cv::Mat image;
+    bool    pooled;      // one extra reference is held by a FramePool
+    qint64  copiedBytes;
+    FrameInfo metadata;
+};
+
+// Recycles frame allocations. acquire() hands out a pool-owned Mat that no
+// Frame references any more; decoding or resizing into it reuses its memory
+// as long as the stream size does not change.
+class FramePool
+{
+public:
+    FramePool();
+
+    cv::Mat& acquire();
+    int size() const { return buffers.size(); }
+    // Drops the pool's references; buffers still in flight stay alive
+    void clear()     { buffers.clear(); }
+
+private:
+    QVector<cv::Mat> buffers;
+};
+
+#endif // FRAME_H
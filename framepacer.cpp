@@ -0,0 +1,73 @@
+#include "framepacer.h"
+#include "config.h"
+#include <qnumeric.h>
+
+FramePacer::FramePacer()
+    : fps(DEFAULT_VIDEO_FPS)
+    , periodNs(1000000000LL / DEFAULT_VIDEO_FPS)
+    , frameIndex(0)
+    , skippedFrames(0)
+    , freeRun(DEFAULT_FREE_RUN)
+{
+}
+
+void FramePacer::setFps(double f)
+{
+    // Containers report 0 or NaN when they do not know the rate
+    if (!(f > 0) || !qIsFinite(f))
+        f = DEFAULT_VIDEO_FPS;
+    fps      = f;
+    periodNs = (qint64) (1e9 / f);
+    reset();
+}
+
+void FramePacer::reset()
+{
+    clock.invalidate();
+    frameIndex = 0;
+}
+
+void FramePacer::start()
+{
+    clock.start();
+    frameIndex = 0;
+}
+
+int FramePacer::framesToSkip()
+{
+    if (freeRun)
+        return 0;
+    if (!clock.isValid())
+    {
+        start();
+        return 0;
+    }
+    qint64 late = clock.nsecsElapsed() - frameIndex * periodNs;
+    if (late < periodNs)
+        return 0;
+    int behind = (int) (late / periodNs);
+    // A stall this long is not worth catching up with: start over
+    if (behind > DEFAULT_MAX_FRAME_SKIP)
+    {
+        start();
+        return 0;
+    }
+    frameIndex    += behind;
+    skippedFrames += behind;
+    return behind;
+}
+
+qint64 FramePacer::usecsUntilDue()
+{
+    if (freeRun)
+        return 0;
+    if (!clock.isValid())
+        start();
+    qint64 early = frameIndex * periodNs - clock.nsecsElapsed();
+    return (early > 0) ? early / 1000 : 0;
+}
+
+void FramePacer::frameShown()
+{
+    frameIndex += 1;
+}
@@ -0,0 +1,43 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <QElapsedTimer>
+
+// Paces video playback against a monotonic clock. The deadline of frame n
+// is start + n * period, so time spent decoding and queueing and sleep
+// jitter do not add up into drift. When playback falls behind by whole
+// frames they are reported to be skipped. In free-run mode there is no
+// pacing at all, for offline throughput runs.
+class FramePacer
+{
+public:
+    FramePacer();
+
+    // Rates that are zero, negative or not finite fall back to DEFAULT_VIDEO_FPS
+    void   setFps(double fps);
+    double getFps() const             { return fps; }
+    void   setFreeRun(bool f)         { freeRun = f; }
+    bool   isFreeRun() const          { return freeRun; }
+    // Restart the schedule at the next frame (after a pause or a seek)
+    void   reset();
+
+    // Frames the caller is too late for; they are taken off the schedule
+    int    framesToSkip();
+    // Time left until the next frame is due, 0 when it is already due
+    qint64 usecsUntilDue();
+    // The current frame has been presented, move on to the next one
+    void   frameShown();
+    int    getSkippedFrames() const   { return skippedFrames; }
+
+private:
+    void   start();
+
+    QElapsedTimer clock;
+    double fps;
+    qint64 periodNs;
+    qint64 frameIndex;
+    int    skippedFrames;
+    bool   freeRun;
+};
+
+#endif // FRAMEPACER_H
@@ -0,0 +1,211 @@
+#include "fusedkernels.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// What a fused kernel computes from the 3x3 neighbourhood
+enum FusedOp {
+    GradX,      // |Gx|
+    GradY,      // |Gy|
+    GradXY,     // (|Gx| + |Gy|) / 2
+    Laplace,    // |Laplacian|
+    Sharpen     // weight * centre minus the 4 cross neighbours
+};
+
+inline int clip255(int v)
+{
+    return v > 255 ? 255 : v;
+}
+
+// addWeighted(a, 0.5, b, 0.5, 0) rounds halves to even
+inline int halfSum(int a, int b)
+{
+    int s = a + b;
+    int h = s >> 1;
+    return h + (s & h & 1);
+}
+
+// u, c, d: rows above, at and below; l, x, r: columns left, at and right
+template<int op, int k>
+inline uchar fusedValue(const uchar *u, const uchar *c, const uchar *d, int l, int x, int r, int weight)
+{
+    if (op == Sharpen)
+    {
+        int v = weight * c[x] - (u[x] + d[x] + c[l] + c[r]);
+        return (uchar) (v < 0 ? 0 : clip255(v));
+    }
+    if (op == Laplace)
+    {
+        int v = (k == 3) ? 2 * (u[l] + u[r] + d[l] + d[r]) - 8 * c[x]
+                         : u[x] + d[x] + c[l] + c[r] - 4 * c[x];
+        return (uchar) clip255(v < 0 ? -v : v);
+    }
+    int gx = (k == 3) ? (u[r] - u[l]) + 2 * (c[r] - c[l]) + (d[r] - d[l]) : c[r] - c[l];
+    int gy = (k == 3) ? (d[l] + 2 * d[x] + d[r]) - (u[l] + 2 * u[x] + u[r]) : d[x] - u[x];
+    int ax = clip255(gx < 0 ? -gx : gx);
+    int ay = clip255(gy < 0 ? -gy : gy);
+    if (op == GradX)
+        return (uchar) ax;
+    if (op == GradY)
+        return (uchar) ay;
+    return (uchar) halfSum(ax, ay);
+}
+
+#ifdef __SSE2__
+// 8 pixels widened to 16 bits
+inline __m128i load8(const uchar *p)
+{
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) p), _mm_setzero_si128());
+}
+
+inline __m128i abs16(__m128i v)
+{
+    return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+// fusedValue() for the 8 pixels at x; x-cn and x+cn+7 must be in the row
+template<int op, int k>
+inline void fusedVector(const uchar *u, const uchar *c, const uchar *d, int x, int cn, uchar *out, int weight)
+{
+    const __m128i max = _mm_set1_epi16(255);
+    __m128i v;
+    if (op == Sharpen)
+    {
+        // packing saturates both ways
+        __m128i cross = _mm_add_epi16(_mm_add_epi16(load8(u + x), load8(d + x)),
+                                      _mm_add_epi16(load8(c + x - cn), load8(c + x + cn)));
+        v = _mm_sub_epi16(_mm_mullo_epi16(load8(c + x), _mm_set1_epi16((short) weight)), cross);
+    }
+    else if (op == Laplace)
+    {
+        if (k == 3)
+        {
+            __m128i corners = _mm_add_epi16(_mm_add_epi16(load8(u + x - cn), load8(u + x + cn)),
+                                            _mm_add_epi16(load8(d + x - cn), load8(d + x + cn)));
+            v = _mm_sub_epi16(_mm_slli_epi16(corners, 1), _mm_slli_epi16(load8(c + x), 3));
+        }
+        else
+        {
+            __m128i cross = _mm_add_epi16(_mm_add_epi16(load8(u + x), load8(d + x)),
+                                          _mm_add_epi16(load8(c + x - cn), load8(c + x + cn)));
+            v = _mm_sub_epi16(cross, _mm_slli_epi16(load8(c + x), 2));
+        }
+        v = _mm_min_epi16(abs16(v), max);
+    }
+    else
+    {
+        __m128i gx, gy;
+        if (k == 3)
+        {
+            __m128i ul = load8(u + x - cn), ur = load8(u + x + cn);
+            __m128i dl = load8(d + x - cn), dr = load8(d + x + cn);
+            __m128i cl = load8(c + x - cn), cr = load8(c + x + cn);
+            __m128i uc = load8(u + x),      dc = load8(d + x);
+            gx = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(ur, ul), _mm_sub_epi16(dr, dl)),
+                               _mm_slli_epi16(_mm_sub_epi16(cr, cl), 1));
+            gy = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(dl, ul), _mm_sub_epi16(dr, ur)),
+                               _mm_slli_epi16(_mm_sub_epi16(dc, uc), 1));
+        }
+        else
+        {
+            gx = _mm_sub_epi16(load8(c + x + cn), load8(c + x - cn));
+            gy = _mm_sub_epi16(load8(d + x), load8(u + x));
+        }
+        __m128i ax = _mm_min_epi16(abs16(gx), max);
+        __m128i ay = _mm_min_epi16(abs16(gy), max);
+        if (op == GradX)
+            v = ax;
+        else if (op == GradY)
+            v = ay;
+        else
+        {
+            __m128i s = _mm_add_epi16(ax, ay);
+            __m128i h = _mm_srli_epi16(s, 1);
+            v = _mm_add_epi16(h, _mm_and_si128(_mm_and_si128(s, h), _mm_set1_epi16(1)));
+        }
+    }
+    _mm_storel_epi64((__m128i*) (out + x), _mm_packus_epi16(v, v));
+}
+#endif
+
+// BORDER_DEFAULT (reflect 101): -1 -> 1, n -> n-2
+inline int reflect101(int i, int n)
+{
+    return i < 0 ? -i : (i >= n ? 2 * n - 2 - i : i);
+}
+
+template<int op, int k>
+void fusedFilter(const cv::Mat &src, cv::Mat &dst, int weight = 0)
+{
+    dst.create(src.size(), src.type());
+    int cn    = src.channels();
+    int width = src.cols * cn;
+    for (int y=0; y<src.rows; y+=1)
+    {
+        const uchar *u = src.ptr<uchar>(reflect101(y - 1, src.rows));
+        const uchar *c = src.ptr<uchar>(y);
+        const uchar *d = src.ptr<uchar>(reflect101(y + 1, src.rows));
+        uchar *out = dst.ptr<uchar>(y);
+
+        // First pixel: the left neighbour is the reflected second pixel
+        int x = 0;
+        for (; x<cn; x+=1)
+            out[x] = fusedValue<op, k>(u, c, d, x + cn, x, x + cn, weight);
+#ifdef __SSE2__
+        for (; x + cn + 8 <= width; x+=8)
+            fusedVector<op, k>(u, c, d, x, cn, out, weight);
+#endif
+        for (; x<width-cn; x+=1)
+            out[x] = fusedValue<op, k>(u, c, d, x - cn, x, x + cn, weight);
+        // Last pixel: the right neighbour is the reflected one before it
+        for (; x<width; x+=1)
+            out[x] = fusedValue<op, k>(u, c, d, x - cn, x, x - cn, weight);
+    }
+}
+
+// Size and type the kernels handle
+bool fusable(const cv::Mat &src, cv::Mat &dst, int ksize)
+{
+    return src.depth() == CV_8U && (ksize == 1 || ksize == 3)
+        && src.rows >= 2 && src.cols >= 2 && dst.data != src.data;
+}
+
+}
+
+bool fusedSobel(const cv::Mat &src, cv::Mat &dst, int direction, int ksize)
+{
+    if (!fusable(src, dst, ksize) || direction < 0 || direction > 2)
+        return false;
+    switch (direction * 4 + ksize)
+    {
+    case 0 * 4 + 1: fusedFilter<GradX, 1>(src, dst);  break;
+    case 0 * 4 + 3: fusedFilter<GradX, 3>(src, dst);  break;
+    case 1 * 4 + 1: fusedFilter<GradY, 1>(src, dst);  break;
+    case 1 * 4 + 3: fusedFilter<GradY, 3>(src, dst);  break;
+    case 2 * 4 + 1: fusedFilter<GradXY, 1>(src, dst); break;
+    case 2 * 4 + 3: fusedFilter<GradXY, 3>(src, dst); break;
+    }
+    return true;
+}
+
+bool fusedLaplacian(const cv::Mat &src, cv::Mat &dst, int ksize)
+{
+    if (!fusable(src, dst, ksize))
+        return false;
+    if (ksize == 3)
+        fusedFilter<Laplace, 3>(src, dst);
+    else
+        fusedFilter<Laplace, 1>(src, dst);
+    return true;
+}
+
+bool fusedSharpen(const cv::Mat &src, cv::Mat &dst, int center)
+{
+    // The sums stay within 16 bits up to a centre of 64
+    if (!fusable(src, dst, 1) || (src.channels() != 1 && src.channels() != 3) || center < 0 || center > 64)
+        return false;
+    fusedFilter<Sharpen, 1>(src, dst, center);
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef FUSEDKERNELS_H
+#define FUSEDKERNELS_H
+
+#include <opencv/cv.h>
+
+// Single-pass versions of filter chains the stages run often. Each reads
+// the 8-bit source once and writes the 8-bit result, without the 16-bit
+// temporaries, and gives exactly what the OpenCV chain gives (borders are
+// BORDER_DEFAULT). They return false, without touching dst, for inputs
+// they do not handle; the caller then runs the OpenCV chain. dst must not
+// share memory with src.
+
+// Sobel (scale 1, CV_16S) + convertScaleAbs; direction 2 adds
+// addWeighted(|Gx|, 0.5, |Gy|, 0.5, 0). 8-bit images, ksize 1 or 3.
+bool fusedSobel(const cv::Mat &src, cv::Mat &dst, int direction, int ksize);
+// Laplacian (scale 1, CV_16S) + convertScaleAbs. 8-bit images, ksize 1 or 3.
+bool fusedLaplacian(const cv::Mat &src, cv::Mat &dst, int ksize);
+// filter2D with the 3x3 cross kernel {0,-1,0; -1,center,-1; 0,-1,0},
+// saturated to 8 bits. 8-bit images with 1 or 3 channels.
+bool fusedSharpen(const cv::Mat &src, cv::Mat &dst, int center);
+
+#endif // FUSEDKERNELS_H
@@ -1,95 +1,402 @@
 #include "imagebuffer.h"
 #include "mattoqimage.h"
+#include "config.h"
+#include <QThread>
+#include <QElapsedTimer>
 
 ImageBuffer::ImageBuffer(QObject *parent, int s, bool fd)
     : QObject(parent)
-    , bufferSize(s)
-    , dropFrame(fd)
+    , head(0)
+    , tail(0)
+    , pending(2)
+    , backSlot(0)
+    , frontSlot(1)
+    , policy(fd ? DropNewest : Block)
+    , blockTimeout(-1)
+    , aborted(0)
+    , consumerWaiting(0)
+    , producerWaiting(0)
+    , bufferSize(qMax(s, 1))
 {
-    // Semaphore initializations
-    freeSlots    = new QSemaphore(bufferSize);
-    usedSlots    = new QSemaphore(0);
-    clearBuffer1 = new QSemaphore(1);
-    clearBuffer2 = new QSemaphore(1);
+    // The ring is rounded up to a power of two so positions can wrap freely;
+    // bufferSize still bounds the number of queued frames. It has at least
+    // two cells: with one, a slot handed back to the producer (pos + cells)
+    // would look just like a published frame (pos + 1), and the producer
+    // could refill it while the consumer is still moving the frame out.
+    int cellCount = 2;
+    while (cellCount < bufferSize)
+        cellCount <<= 1;
+    cellMask = cellCount - 1;
+    cells    = new Cell[cellCount];
+    for (int i=0; i<cellCount; i+=1)
+        storeRelease(cells[i].sequence, i);
+
+    mailboxSlots = QVector<Frame>(3);
+    resetStatistics();
+}
+
+ImageBuffer::~ImageBuffer()
+{
+    delete [] cells;
+}
+
+void ImageBuffer::setPolicy(Policy p, int timeoutMs)
+{
+    blockTimeout.fetchAndStoreOrdered(timeoutMs);
+    policy.fetchAndStoreOrdered(p);
+    // A producer blocked under the old policy re-evaluates
+    QMutexLocker locker(&waitMutex);
+    notFull.wakeAll();
+}
+
+void ImageBuffer::setAborted(bool a)
+{
+    aborted.fetchAndStoreOrdered(a ? 1 : 0);
+    QMutexLocker locker(&waitMutex);
+    notEmpty.wakeAll();
+    notFull.wakeAll();
+}
+
+bool ImageBuffer::hasFrame()
+{
+    return (loadAcquire(pending) & FreshFrame) ||
+           loadAcquire(head) != loadAcquire(tail);
 }
 
-Mat ImageBuffer::getFrame()
+bool ImageBuffer::canPush()
 {
-    // Acquire semaphores
-    clearBuffer2->acquire();
-    usedSlots->acquire();
-    // Temporary data
-    cv::Mat tempFrame;
-    // Take frame from queue
-    imageQueueProtect.lock();
-        tempFrame=imageQueue.dequeue();
-    imageQueueProtect.unlock();
+    unsigned pos = loadAcquire(tail);
+    if (pos - (unsigned) loadAcquire(head) >= (unsigned) bufferSize)
+        return false;
+    // The slot may still be being read by whoever claimed it last lap
+    return (unsigned) loadAcquire(cells[pos & cellMask].sequence) == pos;
+}
 
-    // Release semaphores
-    freeSlots->release();
-    clearBuffer2->release();
-    // Return frame to caller
-    return tempFrame.clone();
+bool ImageBuffer::tryPush(Frame &frame)
+{
+    if (!canPush())
+        return false;
+    unsigned pos = loadAcquire(tail);
+    Cell &cell = cells[pos & cellMask];
+    // Move the handle into the slot; no pixels are copied
+    cell.frame = frame;
+    frame.release();
+    storeRelease(cell.sequence, pos + 1);
+    // Publish the frame to the consumer
+    tail.fetchAndStoreOrdered(pos + 1);
+    return true;
 }
 
-void ImageBuffer::addFrame(const Mat &frame)
+bool ImageBuffer::tryPop(Frame &frame)
 {
-    // Acquire semaphore
-    clearBuffer1->acquire();
-    // If frame dropping is enabled, do not block if buffer is full
-    if(dropFrame)
+    // Both the consumer and a DropOldest producer claim frames here
+    while (true)
     {
-        // Try and acquire semaphore to add frame
-        if(freeSlots->tryAcquire())
+        unsigned pos = loadAcquire(head);
+        Cell &cell = cells[pos & cellMask];
+        int diff = (int) ((unsigned) loadAcquire(cell.sequence) - (pos + 1));
+        if (diff < 0)
+            return false;
+        if (diff == 0 && head.testAndSetOrdered(pos, pos + 1))
         {
-            // Add frame to queue
-            imageQueueProtect.lock();
-                imageQueue.enqueue(frame);
-            imageQueueProtect.unlock();
-            // Release semaphore
-            usedSlots->release();
+            // Move the handle out so the caller becomes the only owner
+            frame = cell.frame;
+            cell.frame.release();
+            // Hand the slot back to the producer for its next lap
+            storeRelease(cell.sequence, pos + cellMask + 1);
+            return true;
         }
+        // The other side claimed this frame first: look again
     }
-    // If buffer is full, wait on semaphore
-    else
+}
+
+bool ImageBuffer::getFrame(Frame &frame, int timeoutMs)
+{
+    QElapsedTimer waitTimer;
+    bool waited = false;
+    while (true)
+    {
+        // A mailbox frame is always newer than anything left in the ring
+        if (loadAcquire(pending) & FreshFrame)
+        {
+            if (getPolicy() == Mailbox)
+            {
+                // Latest frame wins: whatever is still queued is stale
+                Frame stale;
+                while (tryPop(stale))
+                    overwrittenFrames.fetchAndAddRelaxed(1);
+                stale.release();
+                wakeProducer();
+            }
+            takeFromMailbox(frame);
+            break;
+        }
+        if (tryPop(frame))
+        {
+            wakeProducer();
+            break;
+        }
+        if (!waited)
+        {
+            waited = true;
+            waitTimer.start();
+        }
+        // Wait until the producer has published a frame
+        int left = (timeoutMs < 0) ? -1 : qMax(0, timeoutMs - (int) waitTimer.elapsed());
+        if (!waitWhileEmpty(left))
+            return false;
+    }
+    recordWait(consumerWaits, waited ? waitTimer.nsecsElapsed() / 1000 : 0);
+    return true;
+}
+
+bool ImageBuffer::tryGetFrame(Frame &frame)
+{
+    if (!hasFrame())
+        return false;
+    return getFrame(frame);
+}
+
+void ImageBuffer::takeFromMailbox(Frame &frame)
+{
+    // Swap our front slot with the pending one
+    int old   = pending.fetchAndStoreOrdered(frontSlot);
+    frontSlot = old & SlotMask;
+    frame = mailboxSlots[frontSlot];
+    mailboxSlots[frontSlot].release();
+}
+
+bool ImageBuffer::addFrame(const Frame &frame)
+{
+    Frame shared = frame;
+    return passFrame(shared);
+}
+
+bool ImageBuffer::passFrame(Frame &frame)
+{
+    Policy p = getPolicy();
+    if (p == Mailbox)
     {
-        // Acquire semaphore
-        freeSlots->acquire();
-        // Add frame to queue
-        imageQueueProtect.lock();
-            imageQueue.enqueue(frame);
-        imageQueueProtect.unlock();
-        // Release semaphore
-        usedSlots->release();
+        // Publish through the triple buffer; this never waits
+        mailboxSlots[backSlot] = frame;
+        frame.release();
+        int old  = pending.fetchAndStoreOrdered(backSlot | FreshFrame);
+        backSlot = old & SlotMask;
+        if (old & FreshFrame)
+        {
+            // The consumer never saw that one
+            mailboxSlots[backSlot].release();
+            overwrittenFrames.fetchAndAddRelaxed(1);
+        }
+        enqueuedFrames.fetchAndAddRelaxed(1);
+        recordWait(producerWaits, 0);
+        wakeConsumer();
+        emit newFrame();
+        return true;
+    }
+
+    QElapsedTimer waitTimer;
+    bool waited = false;
+    while (!tryPush(frame))
+    {
+        if (p == DropNewest)
+        {
+            droppedFrames.fetchAndAddRelaxed(1);
+            recordWait(producerWaits, 0);
+            return false;
+        }
+        if (p == DropOldest)
+        {
+            // Claim the oldest frame; if the consumer got there first the
+            // push simply succeeds on the next try
+            Frame oldest;
+            if (tryPop(oldest))
+                droppedFrames.fetchAndAddRelaxed(1);
+            else
+                QThread::yieldCurrentThread();
+            continue;
+        }
+        // Block, possibly with a timeout
+        if (!waited)
+        {
+            waited = true;
+            waitTimer.start();
+        }
+        int timeout = loadAcquire(blockTimeout);
+        int left    = (timeout < 0) ? -1 : qMax(0, timeout - (int) waitTimer.elapsed());
+        if (!waitWhileFull(left))
+        {
+            droppedFrames.fetchAndAddRelaxed(1);
+            recordWait(producerWaits, waitTimer.nsecsElapsed() / 1000);
+            return false;
+        }
+        // The policy may have been switched while we waited
+        p = getPolicy();
+        if (p == Mailbox)
+            return passFrame(frame);
     }
-    // Release semaphore
-    clearBuffer1->release();
+    recordWait(producerWaits, waited ? waitTimer.nsecsElapsed() / 1000 : 0);
+    enqueuedFrames.fetchAndAddRelaxed(1);
+    // Only the producer raises the high-water mark
+    int queued = getSizeOfImageBuffer();
+    if (queued > loadAcquire(highWaterMark))
+        highWaterMark.fetchAndStoreOrdered(queued);
+    wakeConsumer();
     emit newFrame();
+    return true;
+}
+
+void ImageBuffer::wakeConsumer()
+{
+    if (loadAcquire(consumerWaiting))
+    {
+        QMutexLocker locker(&waitMutex);
+        notEmpty.wakeOne();
+    }
+}
+
+void ImageBuffer::wakeProducer()
+{
+    if (loadAcquire(producerWaiting))
+    {
+        QMutexLocker locker(&waitMutex);
+        notFull.wakeOne();
+    }
+}
+
+bool ImageBuffer::waitWhileEmpty(int timeoutMs)
+{
+    // Spin briefly: at high frame rates the next frame is usually close
+    for (int i=0; i<DEFAULT_BUFFER_SPIN_COUNT; i+=1)
+    {
+        if (hasFrame())
+            return true;
+        if (isAborted())
+            return false;
+        QThread::yieldCurrentThread();
+    }
+    // Park until the producer publishes. The flag is set with a full barrier
+    // so either we see the new frame or the producer sees us waiting.
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker locker(&waitMutex);
+    consumerWaiting.fetchAndStoreOrdered(1);
+    bool ready = true;
+    while (!hasFrame())
+    {
+        if (isAborted())
+        {
+            ready = false;
+            break;
+        }
+        if (timeoutMs < 0)
+        {
+            notEmpty.wait(&waitMutex);
+            continue;
+        }
+        qint64 left = timeoutMs - timer.elapsed();
+        if (left <= 0 || !notEmpty.wait(&waitMutex, (unsigned long) left))
+        {
+            ready = hasFrame();
+            break;
+        }
+    }
+    consumerWaiting.fetchAndStoreOrdered(0);
+    return ready;
+}
+
+bool ImageBuffer::waitWhileFull(int timeoutMs)
+{
+    for (int i=0; i<DEFAULT_BUFFER_SPIN_COUNT; i+=1)
+    {
+        if (canPush())
+            return true;
+        if (isAborted())
+            return false;
+        QThread::yieldCurrentThread();
+    }
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker locker(&waitMutex);
+    producerWaiting.fetchAndStoreOrdered(1);
+    bool ready = true;
+    while (!canPush() && getPolicy() == Block)
+    {
+        if (isAborted())
+        {
+            ready = false;
+            break;
+        }
+        if (timeoutMs < 0)
+        {
+            notFull.wait(&waitMutex);
+            continue;
+        }
+        qint64 left = timeoutMs - timer.elapsed();
+        if (left <= 0 || !notFull.wait(&waitMutex, (unsigned long) left))
+        {
+            ready = canPush();
+            break;
+        }
+    }
+    producerWaiting.fetchAndStoreOrdered(0);
+    return ready;
+}
+
+void ImageBuffer::recordWait(QAtomicInt *histogram, qint64 usecs)
+{
+    int bucket = 0;
+    while (usecs > 0 && bucket < WaitBuckets-1)
+    {
+        usecs >>= 1;
+        bucket += 1;
+    }
+    histogram[bucket].fetchAndAddRelaxed(1);
+}
+
+ImageBufferStats ImageBuffer::getStatistics()
+{
+    ImageBufferStats stats;
+    stats.enqueued      = loadAcquire(enqueuedFrames);
+    stats.dropped       = loadAcquire(droppedFrames);
+    stats.overwritten   = loadAcquire(overwrittenFrames);
+    stats.highWaterMark = loadAcquire(highWaterMark);
+    stats.capacity      = bufferSize;
+    stats.producerWaits = QVector<int>(WaitBuckets);
+    stats.consumerWaits = QVector<int>(WaitBuckets);
+    for (int i=0; i<WaitBuckets; i+=1)
+    {
+        stats.producerWaits[i] = loadAcquire(producerWaits[i]);
+        stats.consumerWaits[i] = loadAcquire(consumerWaits[i]);
+    }
+    return stats;
+}
+
+void ImageBuffer::resetStatistics()
+{
+    enqueuedFrames.fetchAndStoreOrdered(0);
+    droppedFrames.fetchAndStoreOrdered(0);
+    overwrittenFrames.fetchAndStoreOrdered(0);
+    highWaterMark.fetchAndStoreOrdered(0);
+    for (int i=0; i<WaitBuckets; i+=1)
+    {
+        producerWaits[i].fetchAndStoreOrdered(0);
+        consumerWaits[i].fetchAndStoreOrdered(0);
+    }
 }
 
 void ImageBuffer::clearBuffer()
 {
     // Check if buffer is not empty
-    if(imageQueue.size()!=0)
+    if (getSizeOfImageBuffer() != 0)
     {
-        // Stop adding frames to buffer
-        clearBuffer1->acquire();
-        // Stop taking frames from buffer
-        clearBuffer2->acquire();
-        // Release all remaining slots in queue
-        freeSlots->release(imageQueue.size());
-        // Acquire all queue slots
-        freeSlots->acquire(bufferSize);
-        // Reset usedSlots to zero
-        usedSlots->acquire(imageQueue.size());
-        // Clear buffer
-        imageQueue.clear();
-        // Release all slots
-        freeSlots->release(bufferSize);
-        // Allow getFrame() to resume
-        clearBuffer2->release();
-        // Allow addFrame() to resume
-        clearBuffer1->release();
+        // Drop everything that was published so far
+        Frame discarded;
+        while (tryPop(discarded))
+            discarded.release();
+        if (loadAcquire(pending) & FreshFrame)
+            takeFromMailbox(discarded);
+        wakeProducer();
         qDebug() << "Image buffer successfully cleared.";
     }
     else
@@ -98,5 +405,8 @@ void ImageBuffer::clearBuffer()
 
 int ImageBuffer::getSizeOfImageBuffer()
 {
-    return imageQueue.size();
+    // Both positions are atomics, so this is safe from any thread
+    int queued  = (int) ((unsigned) loadAcquire(tail) - (unsigned) loadAcquire(head));
+    int mailbox = (loadAcquire(pending) & FreshFrame) ? 1 : 0;
+    return qBound(0, queued, bufferSize) + mailbox;
 }
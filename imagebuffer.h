@@ -3,39 +3,132 @@
 
 #include <QObject>
 #include <QMutex>
-#include <QQueue>
-#include <QSemaphore>
+#include <QWaitCondition>
+#include "atomicint.h"
+#include <QVector>
 #include <QImage>
-#include <QObject>
 #include <opencv/highgui.h>
+#include "frame.h"
+
+// Snapshot of the counters of an ImageBuffer
+struct ImageBufferStats {
+    int enqueued;      // frames accepted from the producer
+    int dropped;       // frames discarded by the drop policies or a timeout
+    int overwritten;   // frames replaced by a newer one (mailbox)
+    int highWaterMark; // most frames queued at the same time
+    int capacity;
+    // Wait times: bucket 0 counts calls that did not wait, bucket i
+    // waits of [2^(i-1), 2^i) microseconds; the last bucket is open-ended
+    QVector<int> producerWaits;
+    QVector<int> consumerWaits;
+};
 
+// Ring buffer of frames between one producer and one consumer. The slots
+// hold Frame handles, so a frame changes owner without its pixels being
+// copied. Positions are atomics and every slot carries a sequence number,
+// so a frame is handed over without any lock and the producer can also
+// claim the oldest frame (DropOldest). A thread only parks on a wait
+// condition when the ring is empty (consumer) or full (producer).
+//
+// In Mailbox mode the frames go through a triple buffer instead: the
+// producer never waits and overwrites the pending frame, and the consumer
+// always gets the freshest one (latest frame wins).
 class ImageBuffer : public QObject
 {
     Q_OBJECT
 public:
+    // What the producer does when the ring is full
+    enum Policy {
+        Block,      // wait for a free slot, at most the timeout if one is set
+        DropNewest, // discard the incoming frame
+        DropOldest, // discard the oldest queued frame
+        Mailbox     // keep only the latest frame
+    };
+    enum { WaitBuckets = 20 };
+
     explicit ImageBuffer(QObject *parent = 0, int s = 0, bool fd = false);
+    ~ImageBuffer();
 
-    void addFrame(const cv::Mat& frame);
-    cv::Mat getFrame();
+    // Producer side: addFrame() shares the frame with the buffer, passFrame()
+    // moves the caller's handle in so the consumer ends up as the only owner
+    bool addFrame(const Frame& frame);
+    bool passFrame(Frame& frame);
+    // Consumer side; getFrame() returns false if no frame came within
+    // timeoutMs (-1 waits forever)
+    bool getFrame(Frame& frame, int timeoutMs = -1);
+    bool tryGetFrame(Frame& frame);
+    // Only call while the consumer is not reading
     void clearBuffer();
     int getSizeOfImageBuffer();
 
-    
+    // Can be switched while running. Frames still queued in the ring when
+    // switching to Mailbox are replaced by the next mailbox frame.
+    // timeoutMs bounds the producer wait of the Block policy (-1: forever).
+    void setPolicy(Policy p, int timeoutMs = -1);
+    Policy getPolicy()          { return (Policy) loadAcquire(policy); }
+    // Frames overwritten by a newer one before the consumer took them
+    int  getReplacedFrames()    { return loadAcquire(overwrittenFrames); }
+    ImageBufferStats getStatistics();
+    void resetStatistics();
+    // While aborted nobody waits: getFrame() fails on an empty buffer and a
+    // blocking producer drops its frame. Wakes current waiters; used to stop
+    // the threads on either side.
+    void setAborted(bool a);
+    bool isAborted()            { return loadAcquire(aborted) != 0; }
+
+
 signals:
     void newFrame();
 
 public slots:
 
 private:
-    QMutex imageQueueProtect;
-    QQueue<cv::Mat> imageQueue;
-    QSemaphore *freeSlots;
-    QSemaphore *usedSlots;
-    QSemaphore *clearBuffer1;
-    QSemaphore *clearBuffer2;
+    // One ring slot; sequence tells whose turn it is to use it
+    struct Cell {
+        QAtomicInt sequence;
+        Frame frame;
+    };
+    // The pending mailbox slot carries this bit until the consumer takes it
+    enum { FreshFrame = 0x4, SlotMask = 0x3 };
+
+    bool hasFrame();
+    bool canPush();
+    bool tryPush(Frame& frame);
+    bool tryPop(Frame& frame);
+    bool waitWhileEmpty(int timeoutMs);
+    bool waitWhileFull(int timeoutMs);
+    void takeFromMailbox(Frame& frame);
+    void wakeConsumer();
+    void wakeProducer();
+    void recordWait(QAtomicInt *histogram, qint64 usecs);
+
+    Cell *cells;
+    int cellMask;
+    QAtomicInt head;            // position of the oldest frame
+    QAtomicInt tail;            // position of the next frame, producer only
+    // Triple buffer: the producer owns backSlot, the consumer frontSlot and
+    // the slot in pending is exchanged between them
+    QVector<Frame> mailboxSlots;
+    QAtomicInt pending;
+    int backSlot;
+    int frontSlot;
+    QAtomicInt policy;
+    QAtomicInt blockTimeout;
+    QAtomicInt aborted;
+    QAtomicInt consumerWaiting;
+    QAtomicInt producerWaiting;
+    QMutex waitMutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
     int bufferSize;
-    bool dropFrame;
-    
+    // Telemetry
+    QAtomicInt enqueuedFrames;
+    QAtomicInt droppedFrames;
+    QAtomicInt overwrittenFrames;
+    QAtomicInt highWaterMark;
+    QAtomicInt producerWaits[WaitBuckets];
+    QAtomicInt consumerWaits[WaitBuckets];
+
 };
 
 #endif // IMAGEBUFFER_H
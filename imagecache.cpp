@@ -0,0 +1,146 @@
+#include "imagecache.h"
+
+// Entries kept from earlier sources before their buffers are reused
+#define MAX_CACHE_ENTRIES 16
+
+ImageCache::Entry::Entry()
+    : kind(-1)
+    , a(0)
+    , b(0)
+    , c(0)
+    , id(-1)
+{
+}
+
+ImageCache::ImageCache()
+    : mutex(QMutex::Recursive)
+    , id(-1)
+{
+}
+
+ImageCache::~ImageCache()
+{
+    for (int i=0; i<entries.size(); i+=1)
+        delete entries[i];
+}
+
+void ImageCache::bind(const cv::Mat &source, int i, const FrameInfo &frame)
+{
+    QMutexLocker locker(&mutex);
+    if (i == id)
+        return;
+    src  = source;
+    id   = i;
+    info = frame;
+}
+
+void ImageCache::unbind()
+{
+    QMutexLocker locker(&mutex);
+    src.release();
+    id = -1;
+}
+
+ImageCache::Entry& ImageCache::lookup(int kind, int a, int b, double c, bool &hit)
+{
+    int stale = -1;
+    for (int i=0; i<entries.size(); i+=1)
+    {
+        Entry &e = *entries[i];
+        if (e.kind == kind && e.a == a && e.b == b && e.c == c)
+        {
+            hit  = (e.id == id);
+            e.id = id;
+            return e;
+        }
+        if (e.id != id && stale < 0)
+            stale = i;
+    }
+    hit = false;
+    if (stale < 0 || entries.size() < MAX_CACHE_ENTRIES)
+    {
+        entries.append(new Entry());
+        stale = entries.size() - 1;
+    }
+    // Takes over the buffers of an entry nobody asked for this time
+    Entry &e = *entries[stale];
+    e.kind = kind;
+    e.a    = a;
+    e.b    = b;
+    e.c    = c;
+    e.id   = id;
+    return e;
+}
+
+cv::Mat ImageCache::gray(int code)
+{
+    QMutexLocker locker(&mutex);
+    if (src.channels() == 1)
+        return src;
+    bool hit;
+    Entry &e = lookup(Gray, code, 0, 0, hit);
+    if (!hit)
+        cv::cvtColor(src, e.image, code);
+    return e.image;
+}
+
+cv::Mat ImageCache::boxBlurred()
+{
+    QMutexLocker locker(&mutex);
+    cv::Mat input = gray();
+    bool hit;
+    Entry &e = lookup(BoxBlur, 3, 0, 0, hit);
+    if (!hit)
+        cv::blur(input, e.image, cv::Size(3,3));
+    return e.image;
+}
+
+cv::Mat ImageCache::gaussian(int size, double sigma)
+{
+    QMutexLocker locker(&mutex);
+    cv::Mat input = gray();
+    bool hit;
+    Entry &e = lookup(Gaussian, size, 0, sigma, hit);
+    if (!hit)
+        cv::GaussianBlur(input, e.image, cv::Size(size, size), sigma);
+    return e.image;
+}
+
+cv::Mat ImageCache::edges(int low, int high)
+{
+    QMutexLocker locker(&mutex);
+    cv::Mat input = boxBlurred();
+    bool hit;
+    Entry &e = lookup(Edges, low, high, 0, hit);
+    if (!hit)
+        cv::Canny(input, e.image, low, high);
+    return e.image;
+}
+
+cv::Mat ImageCache::sourceEdges(int low, int high)
+{
+    QMutexLocker locker(&mutex);
+    bool hit;
+    Entry &e = lookup(SourceEdges, low, high, 0, hit);
+    if (!hit)
+        cv::Canny(src, e.image, low, high);
+    return e.image;
+}
+
+const ImageCache::Contours& ImageCache::contours(int low, int high)
+{
+    QMutexLocker locker(&mutex);
+    cv::Mat input = edges(low, high);
+    bool hit;
+    Entry &e = lookup(ContourSet, low, high, 0, hit);
+    if (!hit)
+    {
+        // findContours() writes into its input, and the edges stay cached
+        input.copyTo(e.image);
+        cv::findContours(e.image,
+                        e.contours,            // a vector of contours
+                        CV_RETR_TREE,          // retrieve all contours, reconstructs a full hierarchy
+                        CV_CHAIN_APPROX_NONE); // all pixels of each contours
+    }
+    return e.contours;
+}
@@ -0,0 +1,77 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <vector>
+#include <QVector>
+#include <QMutex>
+#include <opencv/cv.h>
+#include "frame.h"
+
+// Images derived from one source image that several stages need: the gray
+// conversion, smoothed versions, edge maps and contours. Each is computed
+// the first time a stage asks for it and then shared by the other stages
+// of the same source. Entries are keyed on (source id, kind, parameters);
+// binding a new source id invalidates them, but their buffers are kept and
+// reused for the next source. Every thread running stages has its own
+// cache; the detectors it starts may read it at the same time, so lookups
+// are locked (a derived image is computed while holding the lock, which
+// also keeps two detectors from computing the same one).
+class ImageCache
+{
+public:
+    typedef std::vector< std::vector<cv::Point> > Contours;
+
+    ImageCache();
+    ~ImageCache();
+
+    // Everything is derived from source until another id is bound; not
+    // while detectors are reading. frame is the frame it belongs to.
+    void bind(const cv::Mat &source, int id, const FrameInfo &frame);
+    const cv::Mat& source() const   { return src; }
+    // Lets go of the source, so it can be written in place; bind again
+    // before asking for anything
+    void unbind();
+    const FrameInfo& frame() const  { return info; }
+
+    // Images are returned as headers on the cached buffers, which stay
+    // valid while the source is bound
+    cv::Mat gray(int code = CV_RGB2GRAY);
+    // 3x3 box filter of gray()
+    cv::Mat boxBlurred();
+    // Gaussian blur of gray()
+    cv::Mat gaussian(int size, double sigma);
+    // Canny of boxBlurred()
+    cv::Mat edges(int low, int high);
+    // Canny of the source itself, all channels
+    cv::Mat sourceEdges(int low, int high);
+    // Every contour of edges(low, high); valid while the source is bound
+    const Contours& contours(int low, int high);
+
+    // Buffer for a copy of the source to draw on; free again once nobody
+    // references it. Only for the thread that owns the cache.
+    cv::Mat& canvas()               { return canvases.acquire(); }
+
+private:
+    enum Kind { Gray, BoxBlur, Gaussian, Edges, SourceEdges, ContourSet };
+    struct Entry {
+        Entry();
+        int kind;
+        int a, b;       // parameters
+        double c;
+        int id;         // source the entry was computed for
+        cv::Mat image;
+        Contours contours;
+    };
+    // Entry for the key; hit tells whether it is already computed for the
+    // bound source. Only entries of earlier sources are ever reused.
+    Entry& lookup(int kind, int a, int b, double c, bool &hit);
+
+    QMutex mutex; // recursive: derived images ask for what they derive from
+    cv::Mat src;
+    int id;
+    FrameInfo info;
+    QVector<Entry*> entries;
+    FramePool canvases;
+};
+
+#endif // IMAGECACHE_H
@@ -0,0 +1,86 @@
+#include "latencystats.h"
+#include <algorithm>
+
+LatencyStats::LatencyStats(int window)
+    : windowSize(qMax(window, 1))
+{
+    reset();
+}
+
+void LatencyStats::reset()
+{
+    QMutexLocker locker(&statsMutex);
+    for (int i=0; i<LatencyReport::IntervalCount; i+=1)
+        samples[i] = QVector<qint64>(windowSize);
+    next  = 0;
+    count = 0;
+    frames = 0;
+    lost   = 0;
+    lastSequence = -1;
+    lastSource   = -1;
+}
+
+void LatencyStats::addFrame(const Frame &frame)
+{
+    const FrameInfo &info = frame.info();
+    QMutexLocker locker(&statsMutex);
+
+    // A new source restarts the numbering
+    if (info.source == lastSource && lastSequence >= 0 && info.sequence > lastSequence)
+        lost += info.sequence - lastSequence - 1;
+    lastSource   = info.source;
+    lastSequence = info.sequence;
+    frames += 1;
+
+    const qint64 *t = info.stamps;
+    samples[LatencyReport::Capture][next] = t[StageEnqueued]  - t[StageCaptured];
+    samples[LatencyReport::Queue][next]   = t[StageDequeued]  - t[StageEnqueued];
+    samples[LatencyReport::Process][next] = t[StageProcessed] - t[StageDequeued];
+    samples[LatencyReport::Display][next] = t[StageDisplayed] - t[StageProcessed];
+    samples[LatencyReport::Total][next]   = t[StageDisplayed] - t[StageCaptured];
+    next = (next + 1) % windowSize;
+    count = qMin(count + 1, windowSize);
+}
+
+LatencySummary LatencyStats::summarize(QVector<qint64> values, int n)
+{
+    LatencySummary summary;
+    summary.samples = n;
+    summary.p50 = summary.p95 = summary.p99 = 0;
+    if (n == 0)
+        return summary;
+    // Nearest-rank percentiles on a sorted copy of the window
+    std::sort(values.begin(), values.begin() + n);
+    summary.p50 = values[(n - 1) * 50 / 100] / 1000.0;
+    summary.p95 = values[(n - 1) * 95 / 100] / 1000.0;
+    summary.p99 = values[(n - 1) * 99 / 100] / 1000.0;
+    return summary;
+}
+
+LatencyReport LatencyStats::report()
+{
+    LatencyReport r;
+    QMutexLocker locker(&statsMutex);
+    for (int i=0; i<LatencyReport::IntervalCount; i+=1)
+        r.intervals[i] = summarize(samples[i], count);
+    r.frames = frames;
+    r.lost   = lost;
+    return r;
+}
+
+QString LatencyStats::format(const LatencyReport &r)
+{
+    static const char *names[LatencyReport::IntervalCount] =
+        { "capture", "queue", "process", "display", "total" };
+    QString text = QString("frames %1 lost %2; latency p50/p95/p99 ms:")
+                   .arg(r.frames).arg(r.lost);
+    for (int i=0; i<LatencyReport::IntervalCount; i+=1)
+    {
+        text += QString(" %1 %2/%3/%4")
+                .arg(names[i])
+                .arg(r.intervals[i].p50, 0, 'f', 1)
+                .arg(r.intervals[i].p95, 0, 'f', 1)
+                .arg(r.intervals[i].p99, 0, 'f', 1);
+    }
+    return text;
+}
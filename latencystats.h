@@ -0,0 +1,63 @@
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#include <QMutex>
+#include <QVector>
+#include <QString>
+#include "frame.h"
+#include "config.h"
+
+// Percentiles of one latency, in milliseconds
+struct LatencySummary {
+    int    samples;
+    double p50;
+    double p95;
+    double p99;
+};
+
+// Snapshot of a LatencyStats
+struct LatencyReport {
+    enum Interval {
+        Capture,  // captured -> enqueued (includes video pacing)
+        Queue,    // enqueued -> dequeued by the processing thread
+        Process,  // dequeued -> filters done
+        Display,  // filters done -> handed to the GUI
+        Total,    // captured -> handed to the GUI
+        IntervalCount
+    };
+    LatencySummary intervals[IntervalCount];
+    qint64 frames;  // frames recorded
+    qint64 lost;    // sequence numbers that never arrived
+};
+
+// Rolling latency statistics over the last window frames, fed with the
+// frames leaving the pipeline. Frames lost on the way (dropped by a buffer
+// policy or overwritten in a mailbox) show up as gaps in the sequence
+// numbers. Safe to read from any thread.
+class LatencyStats
+{
+public:
+    explicit LatencyStats(int window = DEFAULT_LATENCY_WINDOW);
+
+    // Record a frame that went through every stage
+    void addFrame(const Frame &frame);
+    LatencyReport report();
+    void reset();
+
+    static QString format(const LatencyReport &report);
+
+private:
+    static LatencySummary summarize(QVector<qint64> samples, int count);
+
+    QMutex statsMutex;
+    int windowSize;
+    QVector<qint64> samples[LatencyReport::IntervalCount];
+    int next;
+    int count;
+    qint64 frames;
+    qint64 lost;
+    qint64 lastSequence;
+    int lastSource;
+};
+
+#endif // LATENCYSTATS_H
@@ -140,7 +140,7 @@ void MainWindow::loadImage()
     {
         controller->readImage(filename);
 
-        controller->processingThread->setInputMode(INPUT_VIDEO);
+        controller->processingThread->setInputMode(INPUT_IMAGE);
 
         connect(controller, SIGNAL(newInputFrame(QImage)), this, SLOT(updateInputFrame(QImage)));
         connect(controller->processingThread, SIGNAL(newProcessedFrame(QImage)), this, SLOT(updateOutputFrame(QImage)));
@@ -1,4 +1,5 @@
 #include "mattoqimage.h"
+#include "config.h"
 
 QImage MatToQImage(const Mat& mat)
 {
@@ -17,7 +18,8 @@ QImage MatToQImage(const Mat& mat)
         QImage img(qImageBuffer, mat.cols, mat.rows, mat.step, QImage::Format_Indexed8);
         img.setColorTable(colorTable);
 
-        return img;
+        // Detach from the Mat: its pixels may be reused once we return
+        return img.copy();
     }
     // 8-bits unsigned, NO. OF CHANNELS=3
     if(mat.type()==CV_8UC3)
@@ -34,3 +36,17 @@ QImage MatToQImage(const Mat& mat)
         return QImage();
     }
 }
+
+DisplayScaler::DisplayScaler()
+    : displaySize(DEFAULT_DISPLAY_WIDTH, DEFAULT_DISPLAY_HEIGHT)
+{
+}
+
+QImage DisplayScaler::toQImage(const Mat &frame)
+{
+    if (frame.empty() || frame.size() == displaySize)
+        return MatToQImage(frame);
+    // Area interpolation keeps thin overlays visible when shrinking
+    cv::resize(frame, scaled, displaySize, 0, 0, cv::INTER_AREA);
+    return MatToQImage(scaled);
+}
@@ -10,4 +10,21 @@ using namespace cv;
 
 QImage MatToQImage(const Mat&);
 
+// Converts frames for a UI label. Frames are scaled to the label size into
+// a buffer that is kept from frame to frame, so processing runs at the
+// working resolution and only the frames that are shown pay for a resize.
+class DisplayScaler
+{
+public:
+    DisplayScaler();
+
+    void setDisplaySize(const cv::Size &s) { displaySize = s; }
+    cv::Size getDisplaySize() const        { return displaySize; }
+    QImage toQImage(const Mat &frame);
+
+private:
+    cv::Size displaySize;
+    cv::Mat  scaled;
+};
+
 #endif // MATTOQIMAGE_H
@@ -0,0 +1,160 @@
+#include "morphology.h"
+#include <cstring>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+struct MaxOp {
+    enum { identity = 0 };  // ignored outside the image
+    static uchar apply(uchar a, uchar b) { return a > b ? a : b; }
+#ifdef __SSE2__
+    static __m128i apply(__m128i a, __m128i b) { return _mm_max_epu8(a, b); }
+#endif
+};
+
+struct MinOp {
+    enum { identity = 255 };
+    static uchar apply(uchar a, uchar b) { return a < b ? a : b; }
+#ifdef __SSE2__
+    static __m128i apply(__m128i a, __m128i b) { return _mm_min_epu8(a, b); }
+#endif
+};
+
+// out = op(a, b) over n bytes
+template<class Op>
+inline void combine(const uchar *a, const uchar *b, uchar *out, int n)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i+=16)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+        _mm_storeu_si128((__m128i*) (out + i), Op::apply(va, vb));
+    }
+#endif
+    for (; i<n; i+=1)
+        out[i] = Op::apply(a[i], b[i]);
+}
+
+// The sequence is padded with radius identity elements at both ends and
+// cut into blocks of one window, w = 2*radius+1. g runs forward within a
+// block and h backward, so the window starting at padded element j is
+// op(h[j], g[j+w-1]): the end of one block and the start of the next.
+
+// Along the rows; an element is a pixel of cn bytes. g and h take a line
+// of (cols + 2*radius) pixels.
+template<class Op>
+void rowPass(const cv::Mat &src, cv::Mat &dst, int radius, uchar *g, uchar *h)
+{
+    int cn = src.channels();
+    int n  = src.cols;
+    int w  = 2 * radius + 1;
+    int L  = n + 2 * radius;
+    for (int y=0; y<src.rows; y+=1)
+    {
+        const uchar *x = src.ptr<uchar>(y);
+        uchar *out = dst.ptr<uchar>(y);
+
+        for (int i=0, k=0; i<L; i+=1, k = (k + 1 == w) ? 0 : k + 1)
+        {
+            bool inside = i >= radius && i < radius + n;
+            for (int c=0; c<cn; c+=1)
+            {
+                uchar v = inside ? x[(i - radius) * cn + c] : (uchar) Op::identity;
+                g[i * cn + c] = (k == 0) ? v : Op::apply(g[(i - 1) * cn + c], v);
+            }
+        }
+        for (int i=L-1, k=(L-1)%w; i>=0; i-=1, k = (k == 0) ? w - 1 : k - 1)
+        {
+            bool inside = i >= radius && i < radius + n;
+            for (int c=0; c<cn; c+=1)
+            {
+                uchar v = inside ? x[(i - radius) * cn + c] : (uchar) Op::identity;
+                h[i * cn + c] = (k == w - 1 || i == L - 1) ? v : Op::apply(h[(i + 1) * cn + c], v);
+            }
+        }
+        combine<Op>(h, g + (w - 1) * cn, out, n * cn);
+    }
+}
+
+// Along the columns, in place; an element is a whole row. g and h take
+// rows + 2*radius rows.
+template<class Op>
+void columnPass(cv::Mat &img, int radius, cv::Mat &g, cv::Mat &h)
+{
+    int n     = img.rows;
+    int w     = 2 * radius + 1;
+    int L     = n + 2 * radius;
+    int width = img.cols * img.channels();
+
+    for (int i=0, k=0; i<L; i+=1, k = (k + 1 == w) ? 0 : k + 1)
+    {
+        uchar *gi = g.ptr<uchar>(i);
+        bool inside = i >= radius && i < radius + n;
+        if (k == 0)
+        {
+            if (inside)
+                memcpy(gi, img.ptr<uchar>(i - radius), width);
+            else
+                memset(gi, Op::identity, width);
+        }
+        else if (inside)
+            combine<Op>(g.ptr<uchar>(i - 1), img.ptr<uchar>(i - radius), gi, width);
+        else
+            memcpy(gi, g.ptr<uchar>(i - 1), width);
+    }
+    for (int i=L-1, k=(L-1)%w; i>=0; i-=1, k = (k == 0) ? w - 1 : k - 1)
+    {
+        uchar *hi = h.ptr<uchar>(i);
+        bool inside = i >= radius && i < radius + n;
+        if (k == w - 1 || i == L - 1)
+        {
+            if (inside)
+                memcpy(hi, img.ptr<uchar>(i - radius), width);
+            else
+                memset(hi, Op::identity, width);
+        }
+        else if (inside)
+            combine<Op>(h.ptr<uchar>(i + 1), img.ptr<uchar>(i - radius), hi, width);
+        else
+            memcpy(hi, h.ptr<uchar>(i + 1), width);
+    }
+    // img is only written once g and h hold everything read from it
+    for (int j=0; j<n; j+=1)
+        combine<Op>(h.ptr<uchar>(j), g.ptr<uchar>(j + w - 1), img.ptr<uchar>(j), width);
+}
+
+template<class Op>
+void squarePass(const cv::Mat &src, cv::Mat &dst, int radius, cv::Mat &g, cv::Mat &h)
+{
+    int width = src.cols * src.channels();
+    int line  = (src.cols + 2 * radius) * src.channels();
+    dst.create(src.size(), src.type());
+    // The row pass uses the first row as its line buffer
+    g.create(src.rows + 2 * radius, std::max(width, line), CV_8U);
+    h.create(g.size(), CV_8U);
+    rowPass<Op>(src, dst, radius, g.ptr<uchar>(0), h.ptr<uchar>(0));
+    columnPass<Op>(dst, radius, g, h);
+}
+
+}
+
+void squareMorphology(const cv::Mat &src, cv::Mat &dst, bool dilate, int radius, cv::Mat &g, cv::Mat &h)
+{
+    if (src.depth() != CV_8U)
+    {
+        if (dilate)
+            cv::dilate(src, dst, cv::Mat(), cv::Point(-1, -1), radius);
+        else
+            cv::erode(src, dst, cv::Mat(), cv::Point(-1, -1), radius);
+        return;
+    }
+    if (dilate)
+        squarePass<MaxOp>(src, dst, radius, g, h);
+    else
+        squarePass<MinOp>(src, dst, radius, g, h);
+}
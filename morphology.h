@@ -0,0 +1,16 @@
+#ifndef MORPHOLOGY_H
+#define MORPHOLOGY_H
+
+#include <opencv/cv.h>
+
+// Dilation (max) or erosion (min) over the square of side 2*radius+1
+// around every pixel. Neighbours outside the image are ignored, as with the
+// default border of cv::dilate and cv::erode, so the result is the same as
+// theirs with the 3x3 element and radius iterations. 8-bit images take the
+// van Herk/Gil-Werman running min/max, one row pass and one column pass of
+// about three comparisons per pixel whatever the radius; other depths go to
+// OpenCV. g and h hold the running values; dst must not share memory with
+// src.
+void squareMorphology(const cv::Mat &src, cv::Mat &dst, bool dilate, int radius, cv::Mat &g, cv::Mat &h);
+
+#endif // MORPHOLOGY_H
@@ -0,0 +1,61 @@
+#include "parallel.h"
+#include "atomicint.h"
+#include <QSemaphore>
+#include <QRunnable>
+#include <QThreadPool>
+
+namespace {
+
+// One parallelFor() call; parts are claimed one at a time by whoever is free
+struct Parts {
+    ParallelTask *task;
+    int end;
+    QAtomicInt next;
+};
+
+void runParts(Parts &parts)
+{
+    for (int i=parts.next.fetchAndAddRelaxed(1); i<parts.end; i=parts.next.fetchAndAddRelaxed(1))
+        parts.task->run(i);
+}
+
+class PartRunner : public QRunnable
+{
+public:
+    PartRunner(Parts *p, QSemaphore *d) : parts(p), done(d) {}
+    void run()
+    {
+        runParts(*parts);
+        done->release();
+    }
+private:
+    Parts *parts;
+    QSemaphore *done;
+};
+
+}
+
+void parallelFor(ParallelTask &task, int first, int end, QThreadPool *pool)
+{
+    Parts parts;
+    parts.task = &task;
+    parts.end  = end;
+    storeRelease(parts.next, first);
+
+    if (!pool)
+        pool = QThreadPool::globalInstance();
+    QSemaphore done;
+    int helpers = 0;
+    while (helpers < end - first - 1)
+    {
+        PartRunner *runner = new PartRunner(&parts, &done);
+        if (!pool->tryStart(runner))
+        {
+            delete runner;
+            break;
+        }
+        helpers += 1;
+    }
+    runParts(parts);
+    done.acquire(helpers);
+}
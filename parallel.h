@@ -0,0 +1,20 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+class QThreadPool;
+
+// Work split into numbered parts, for parallelFor()
+class ParallelTask
+{
+public:
+    virtual ~ParallelTask() {}
+    virtual void run(int part) = 0;
+};
+
+// Runs task.run(i) for every i in [first, end) on pool (0: the global one).
+// The calling thread takes parts too and only idle pool threads are
+// borrowed, so a busy pool never holds it up. Parts are handed out in
+// ascending order; returns once all of them are done.
+void parallelFor(ParallelTask &task, int first, int end, QThreadPool *pool = 0);
+
+#endif // PARALLEL_H
@@ -2,11 +2,30 @@
 #define PROCESSINGTHREAD_H
 #include <QThread>
 #include <QtGui>
+#include <QSharedPointer>
 #include <opencv/highgui.h>
 #include "imagebuffer.h"
+#include "frame.h"
+#include "latencystats.h"
+#include "filterpipeline.h"
+#include "stagedexecutor.h"
+#include "mattoqimage.h"
 #include "structures.h"
 
-class ProcessingThread : public QThread
+// Everything a frame is processed with. Published snapshots are never
+// modified: a setter copies the current one, changes the copy and swaps it
+// in, and the processing thread takes one snapshot per frame. Neither side
+// holds a lock while the other works.
+struct ProcessingConfig {
+    ImageProcessingFlags    filters;
+    ImageProcessingSettings settings;
+    cv::Mat logo;
+    QRect   logoROI;
+    QPoint  logoOrigen;
+    int     version;    // bumped by every change
+};
+
+class ProcessingThread : public QThread, public PipelineSink
 {
     Q_OBJECT
 
@@ -16,88 +35,156 @@ public:
 
     void stopProcessingThread();
     int  getCurrentSizeOfBuffer();
+    // Spread the filters over segments threads with up to frames frames in
+    // flight; fewer than 2 of either runs them on this thread. Applied
+    // before the next frame.
+    void setPipelineParallelism(int segments, int frames);
+    // Run the detectors of consecutive overlays at the same time, on the
+    // image without overlays; applied before the next frame
+    void setConcurrentDetectors(bool c);
     void updateFlags(int, bool);
 
-    void setSaltPepperDensity(int v)    { QMutexLocker locker(&updM); settings.saltPepperNoiseDensity = v; }
-    void setColorSpace(int v)           { QMutexLocker locker(&updM); settings.colorSpace = v; }
-    void setDilateIterations(int v)     { QMutexLocker locker(&updM); settings.dilateIterations = v; }
-    void setErodeIterations(int v)      { QMutexLocker locker(&updM); settings.erodeIterations = v; }
-    void setOpenIterations(int v)       { QMutexLocker locker(&updM); settings.openIterations = v; }
-    void setCloseIterations(int v)      { QMutexLocker locker(&updM); settings.closeIterations = v; }
-    void setBlurSize(int v)             { QMutexLocker locker(&updM); settings.blurSize = v; }
-    void setBlurSigma(double v)         { QMutexLocker locker(&updM); settings.blurSigma = v; }
-    void setSobelDirection(int v)       { QMutexLocker locker(&updM); settings.sobelDirection = v; }
-    void setSobelKernelSize(int v)      { QMutexLocker locker(&updM); settings.sobelKernelSize = v; }
-    void setLaplacianKernelSize(int v)  { QMutexLocker locker(&updM); settings.laplacianKernelSize = v; }
-    void setsharpKernelCenter(int v)    { QMutexLocker locker(&updM); settings.sharpKernelCenter = v; }
-    void setCannyLowThres(int v)        { QMutexLocker locker(&updM); settings.cannyLowThres = v; }
-    void setCannyHighThres(int v)       { QMutexLocker locker(&updM); settings.cannyHighThres = v; }
-    void setLinesHoughVotes(int v)      { QMutexLocker locker(&updM); settings.linesHoughVotes = v; }
-    void setCirclesHoughMin(int v)      { QMutexLocker locker(&updM); settings.circlesHoughMin = v; }
-    void setCirclesHoughMax(int v)      { QMutexLocker locker(&updM); settings.circlesHoughMax = v; }
-    void setContoursThreshold(int v)    { QMutexLocker locker(&updM); settings.contoursThres = v; }
-    void setBoundingBoxThres(int v)     { QMutexLocker locker(&updM); settings.boundingBoxThres = v; }
-    void setEnclosingCircleThres(int v) { QMutexLocker locker(&updM); settings.enclosingCircleThres = v; }
-    void setHarrisCornerThres(int v)    { QMutexLocker locker(&updM); settings.harrisCornerThres = v; }
-    void setFastThres(int v)            { QMutexLocker locker(&updM); settings.fastThreshold = v; }
-    void setSurfThres(int v)            { QMutexLocker locker(&updM); settings.surfThreshold = v; }
-    void setSiftContrastThres(double v) { QMutexLocker locker(&updM); settings.siftContrastThres = v; }
-    void setSiftEdgeThres(int v)        { QMutexLocker locker(&updM); settings.siftEdgeThres = v; }
-    void setInputMode(int v)            { QMutexLocker locker(&inputMutex); inputMode = v; }
-    void setCurrentImage(cv::Mat frame) { currentFrame = frame; }
-    void pause()                        { QMutexLocker locker(&pauseMutex); paused = true; }
-    void play()                         { QMutexLocker locker(&pauseMutex); paused = false; }
-    bool isPaused()                     { return paused; }
+    void setSaltPepperDensity(int v)    { updateSetting(&ImageProcessingSettings::saltPepperNoiseDensity, v); }
+    void setSaltPepperSeed(int v)       { updateSetting(&ImageProcessingSettings::saltPepperSeed, v); }
+    void setColorSpace(int v)           { updateSetting(&ImageProcessingSettings::colorSpace, v); }
+    void setDilateIterations(int v)     { updateSetting(&ImageProcessingSettings::dilateIterations, v); }
+    void setErodeIterations(int v)      { updateSetting(&ImageProcessingSettings::erodeIterations, v); }
+    void setOpenIterations(int v)       { updateSetting(&ImageProcessingSettings::openIterations, v); }
+    void setCloseIterations(int v)      { updateSetting(&ImageProcessingSettings::closeIterations, v); }
+    void setBlurSize(int v)             { updateSetting(&ImageProcessingSettings::blurSize, v); }
+    void setBlurSigma(double v)         { updateSetting(&ImageProcessingSettings::blurSigma, v); }
+    void setBlurBoxSize(int v)          { updateSetting(&ImageProcessingSettings::blurBoxSize, v); }
+    void setSobelDirection(int v)       { updateSetting(&ImageProcessingSettings::sobelDirection, v); }
+    void setSobelKernelSize(int v)      { updateSetting(&ImageProcessingSettings::sobelKernelSize, v); }
+    void setLaplacianKernelSize(int v)  { updateSetting(&ImageProcessingSettings::laplacianKernelSize, v); }
+    void setsharpKernelCenter(int v)    { updateSetting(&ImageProcessingSettings::sharpKernelCenter, v); }
+    void setCannyLowThres(int v)        { updateSetting(&ImageProcessingSettings::cannyLowThres, v); }
+    void setCannyHighThres(int v)       { updateSetting(&ImageProcessingSettings::cannyHighThres, v); }
+    void setLinesHoughVotes(int v)      { updateSetting(&ImageProcessingSettings::linesHoughVotes, v); }
+    void setCirclesHoughMin(int v)      { updateSetting(&ImageProcessingSettings::circlesHoughMin, v); }
+    void setCirclesHoughMax(int v)      { updateSetting(&ImageProcessingSettings::circlesHoughMax, v); }
+    void setContoursThreshold(int v)    { updateSetting(&ImageProcessingSettings::contoursThres, v); }
+    void setBoundingBoxThres(int v)     { updateSetting(&ImageProcessingSettings::boundingBoxThres, v); }
+    void setEnclosingCircleThres(int v) { updateSetting(&ImageProcessingSettings::enclosingCircleThres, v); }
+    void setHarrisCornerThres(int v)    { updateSetting(&ImageProcessingSettings::harrisCornerThres, v); }
+    void setHarrisMaxCorners(int v)     { updateSetting(&ImageProcessingSettings::harrisMaxCorners, v); }
+    void setFastThres(int v)            { updateSetting(&ImageProcessingSettings::fastThreshold, v); }
+    void setSurfThres(int v)            { updateSetting(&ImageProcessingSettings::surfThreshold, v); }
+    void setSiftContrastThres(double v) { updateSetting(&ImageProcessingSettings::siftContrastThres, v); }
+    void setSiftEdgeThres(int v)        { updateSetting(&ImageProcessingSettings::siftEdgeThres, v); }
+    void setFeatureTrackInterval(int v) { updateSetting(&ImageProcessingSettings::featureTrackInterval, v); }
+    void setFeatureTrackMinPoints(int v) { updateSetting(&ImageProcessingSettings::featureTrackMinPoints, v); }
+    void setInputMode(int v);
+    void setCurrentImage(cv::Mat frame);
+    // Logo blended into the input frames when ShowLogo is set; the ROI is
+    // given in input label coordinates
+    void setLogo(cv::Mat logoImage);
+    void setLogoROI(QRect roi, QPoint origen);
+    void pause();
+    void play();
+    bool isPaused()                     { QMutexLocker locker(&stateMutex); return paused; }
 
-    int getColorSpace()           const { return settings.colorSpace; }
-    int getSaltPepperDensity()    const { return settings.saltPepperNoiseDensity; }
-    int getDilateIterations()     const { return settings.dilateIterations; }
-    int getErodeIterations()      const { return settings.erodeIterations; }
-    int getOpenIterations()       const { return settings.openIterations; }
-    int getCloseIterations()      const { return settings.closeIterations; }
-    int getBlurSize()             const { return settings.blurSize; }
-    int getSobelDirection()       const { return settings.sobelDirection; }
-    int getSobelKernelSize()      const { return settings.sobelKernelSize; }
-    int getLaplacianKernelSize()  const { return settings.laplacianKernelSize; }
-    int getsharpKernelCenter()    const { return settings.sharpKernelCenter; }
-    int getCannyLowThres()        const { return settings.cannyLowThres; }
-    int getCannyHighThres()       const { return settings.cannyHighThres; }
-    int getLinesHoughVotes()      const { return settings.linesHoughVotes; }
-    int getCirclesHoughMin()      const { return settings.circlesHoughMin; }
-    int getCirclesHoughMax()      const { return settings.circlesHoughMax; }
-    int getContourThreshold()     const { return settings.contoursThres; }
-    int getBoundingBoxThres()     const { return settings.boundingBoxThres; }
-    int getEnclosingCircleThres() const { return settings.enclosingCircleThres; }
-    int getHarrisCornerThres()    const { return settings.harrisCornerThres; }
-    int getFastThres()            const { return settings.fastThreshold; }
-    int getSurfThres()            const { return settings.surfThreshold; }
-    int getSiftEdgeThres()        const { return settings.siftEdgeThres; }
-    double getSiftContrastThres() const { return settings.siftContrastThres; }
-    double getBlurSigma()         const { return settings.blurSigma; }
+    int getColorSpace()           const { return snapshot()->settings.colorSpace; }
+    int getSaltPepperDensity()    const { return snapshot()->settings.saltPepperNoiseDensity; }
+    int getSaltPepperSeed()       const { return snapshot()->settings.saltPepperSeed; }
+    int getDilateIterations()     const { return snapshot()->settings.dilateIterations; }
+    int getErodeIterations()      const { return snapshot()->settings.erodeIterations; }
+    int getOpenIterations()       const { return snapshot()->settings.openIterations; }
+    int getCloseIterations()      const { return snapshot()->settings.closeIterations; }
+    int getBlurSize()             const { return snapshot()->settings.blurSize; }
+    int getBlurBoxSize()          const { return snapshot()->settings.blurBoxSize; }
+    int getSobelDirection()       const { return snapshot()->settings.sobelDirection; }
+    int getSobelKernelSize()      const { return snapshot()->settings.sobelKernelSize; }
+    int getLaplacianKernelSize()  const { return snapshot()->settings.laplacianKernelSize; }
+    int getsharpKernelCenter()    const { return snapshot()->settings.sharpKernelCenter; }
+    int getCannyLowThres()        const { return snapshot()->settings.cannyLowThres; }
+    int getCannyHighThres()       const { return snapshot()->settings.cannyHighThres; }
+    int getLinesHoughVotes()      const { return snapshot()->settings.linesHoughVotes; }
+    int getCirclesHoughMin()      const { return snapshot()->settings.circlesHoughMin; }
+    int getCirclesHoughMax()      const { return snapshot()->settings.circlesHoughMax; }
+    int getContourThreshold()     const { return snapshot()->settings.contoursThres; }
+    int getBoundingBoxThres()     const { return snapshot()->settings.boundingBoxThres; }
+    int getEnclosingCircleThres() const { return snapshot()->settings.enclosingCircleThres; }
+    int getHarrisCornerThres()    const { return snapshot()->settings.harrisCornerThres; }
+    int getHarrisMaxCorners()     const { return snapshot()->settings.harrisMaxCorners; }
+    int getFastThres()            const { return snapshot()->settings.fastThreshold; }
+    int getSurfThres()            const { return snapshot()->settings.surfThreshold; }
+    int getSiftEdgeThres()        const { return snapshot()->settings.siftEdgeThres; }
+    double getSiftContrastThres() const { return snapshot()->settings.siftContrastThres; }
+    double getBlurSigma()         const { return snapshot()->settings.blurSigma; }
+    int getFeatureTrackInterval() const { return snapshot()->settings.featureTrackInterval; }
+    int getFeatureTrackMinPoints() const { return snapshot()->settings.featureTrackMinPoints; }
     cv::Mat getProcessedFrame()   const { return processedFrame; }
-    bool getFilter(int index)     const { return filters.flags[index]; }
+    qint64 getBytesCopiedPerFrame() const { return bytesCopiedPerFrame; }
+    // Harris corners of the last processed frame (position and response)
+    std::vector<cv::KeyPoint> getCorners() { QMutexLocker locker(&cornersMutex); return corners; }
+    // Rolling capture-to-display latency and frames lost on the way
+    LatencyReport getLatencyReport()    { return latency.report(); }
+    bool getFilter(int index)     const { return snapshot()->filters.flags[index]; }
+
+public slots:
+    // A new frame was queued; wakes an idle still-image loop
+    void wakeUp();
 
 private:
-    ImageBuffer   *outputBuffer;
-    volatile bool stopped;
+    // Current settings; a snapshot stays valid however long it is used
+    QSharedPointer<const ProcessingConfig> snapshot() const;
+    void updateSetting(int ImageProcessingSettings::*field, int v);
+    void updateSetting(double ImageProcessingSettings::*field, double v);
+    // Call with updM held: makes next the current snapshot
+    void publish(ProcessingConfig *next);
+    // The still image has to be processed again
+    void requestReprocess();
+    bool isStopped()                    { QMutexLocker locker(&stateMutex); return stopped; }
+    cv::Rect displayToFrame(const ProcessingConfig &c, const cv::Size &frameSize);
+    // Last step of every frame, in order; runs on the last segment thread
+    // when the executor is used
+    void pipelineDone(PipelineJob &job);
+
+    ImageBuffer   *inputBuffer;
+    bool          stopped;
     bool          paused;
     int           currentSizeOfBuffer;
     int           inputMode;
     QMutex        inputMutex;
-    QMutex        stoppedMutex;
-    QMutex        pauseMutex;
-    QMutex        updM; // Update Members Mutex
-    // Image processing flags
-    ImageProcessingFlags filters;
-    // Image processing settings
-    ImageProcessingSettings settings;
-    cv::Mat currentFrame;
+    // Guards paused and stopped; stateChanged is signalled when either changes
+    QMutex         stateMutex;
+    QWaitCondition stateChanged;
+    // Only held to read or swap the config pointer
+    mutable QMutex updM; // Update Members Mutex
+    QSharedPointer<const ProcessingConfig> config;
+    // Still-image mode only runs the filters when something changed;
+    // reprocessMutex also guards currentFrame
+    bool           reprocess;
+    QMutex         reprocessMutex;
+    QWaitCondition reprocessCondition;
+    // The enabled filters, rebuilt when the config version changes
+    FilterPipeline pipeline;
+    int           pipelineVersion;
+    StagedExecutor *executor;
+    bool          useExecutor;
+    QMutex        parallelismMutex;
+    int           pipelineSegments;
+    int           framesInFlight;
+    bool          concurrentDetectors;
+    bool          parallelismChanged;
+    Frame   currentFrame;
     cv::Mat processedFrame;
+    // Scale frames down for the input and output labels
+    DisplayScaler inputDisplay;
+    DisplayScaler outputDisplay;
+    // Bytes duplicated by copy-on-write for the last processed frame
+    qint64  bytesCopiedPerFrame;
+    std::vector<cv::KeyPoint> corners;
+    QMutex  cornersMutex;
+    LatencyStats latency;
+    qint64  reportedFrames;
 
 protected:
     void run();
 
 signals:
+    void newInputFrame(const QImage &frame);
     void newProcessedFrame(const QImage &frame);
     void newProcessedHistogram(const QImage &hist);
 
@@ -0,0 +1,183 @@
+#include "stagedexecutor.h"
+#include "config.h"
+
+// A new split must make the slowest segment this much faster
+#define REBALANCE_GAIN 1.1
+
+SegmentWorker::SegmentWorker(StagedExecutor *e, int i)
+    : QThread()
+    , executor(e)
+    , index(i)
+    , first(0)
+    , last(0)
+    , stopped(false)
+{
+}
+
+void SegmentWorker::setRange(int f, int l)
+{
+    QMutexLocker locker(&queueMutex);
+    first = f;
+    last  = l;
+}
+
+void SegmentWorker::push(PipelineJob &job)
+{
+    QMutexLocker locker(&queueMutex);
+    jobs.enqueue(job);
+    // Drop our reference before the worker can see the frame, so that it
+    // is the only owner and in-place stages need no copy
+    job = PipelineJob();
+    jobReady.wakeOne();
+}
+
+void SegmentWorker::stopWorker()
+{
+    QMutexLocker locker(&queueMutex);
+    stopped = true;
+    jobReady.wakeOne();
+}
+
+void SegmentWorker::run()
+{
+    while (1)
+    {
+        queueMutex.lock();
+        while (jobs.isEmpty() && !stopped)
+            jobReady.wait(&queueMutex);
+        if (stopped)
+        {
+            queueMutex.unlock();
+            break;
+        }
+        PipelineJob job = jobs.dequeue();
+        int f = first;
+        int l = last;
+        queueMutex.unlock();
+
+        executor->pipeline->runStages(job, f, l, cache);
+        executor->forward(index, job);
+    }
+}
+
+StagedExecutor::StagedExecutor(PipelineSink *s, int segments, int maxFrames)
+    : sink(s)
+    , pipeline(0)
+    , maxInFlight(qMax(maxFrames, 1))
+    , segments(0)
+    , sinceSplit(0)
+    , inFlight(0)
+    , nextTicket(0)
+    , nextToFinish(0)
+{
+    for (int i=0; i<qMax(segments, 1); i+=1)
+    {
+        workers.append(new SegmentWorker(this, i));
+        workers.last()->start(DEFAULT_PROC_THREAD_PRIO);
+    }
+}
+
+StagedExecutor::~StagedExecutor()
+{
+    drain();
+    for (int i=0; i<workers.size(); i+=1)
+    {
+        workers[i]->stopWorker();
+        workers[i]->wait();
+        delete workers[i];
+    }
+}
+
+void StagedExecutor::configure(FilterPipeline *p)
+{
+    pipeline = p;
+    apply(pipeline->partition(qMax(qMin(workers.size(), pipeline->stageCount()), 1)));
+}
+
+void StagedExecutor::apply(const QVector<int> &split)
+{
+    // An empty segment would only add a hand-off per frame
+    bounds.clear();
+    bounds.append(split[0]);
+    for (int i=1; i<split.size(); i+=1)
+        if (split[i] > bounds.last())
+            bounds.append(split[i]);
+    segments = qMax(bounds.size() - 1, 1);
+    for (int i=0; i<workers.size(); i+=1)
+    {
+        if (i < bounds.size() - 1)
+            workers[i]->setRange(bounds[i], bounds[i+1]);
+        else
+            workers[i]->setRange(0, 0);
+    }
+    sinceSplit = 0;
+}
+
+void StagedExecutor::rebalance()
+{
+    sinceSplit = 0;
+    // The first split used placeholder costs; by now every stage has run
+    QVector<int> split = pipeline->partition(qMax(qMin(workers.size(), pipeline->stageCount()), 1));
+    if (pipeline->bottleneck(split) * REBALANCE_GAIN >= pipeline->bottleneck(bounds))
+        return;
+    // The workers only change ranges with nothing in flight
+    drain();
+    apply(split);
+}
+
+void StagedExecutor::submit(PipelineJob &job)
+{
+    sinceSplit += 1;
+    if (pipeline && sinceSplit >= DEFAULT_REBALANCE_INTERVAL)
+        rebalance();
+
+    flightMutex.lock();
+    while (inFlight >= maxInFlight)
+        flightChanged.wait(&flightMutex);
+    inFlight += 1;
+    job.ticket = nextTicket;
+    nextTicket += 1;
+    flightMutex.unlock();
+
+    FilterPipeline::begin(job);
+    workers[0]->push(job);
+}
+
+void StagedExecutor::drain()
+{
+    QMutexLocker locker(&flightMutex);
+    while (inFlight > 0)
+        flightChanged.wait(&flightMutex);
+}
+
+void StagedExecutor::forward(int index, PipelineJob &job)
+{
+    if (index + 1 < segments)
+        workers[index + 1]->push(job);
+    else
+        finish(job);
+}
+
+void StagedExecutor::finish(PipelineJob &job)
+{
+    int done = 0;
+    reorderMutex.lock();
+    finished.insert(job.ticket, job);
+    job = PipelineJob();
+    // Release every frame that is next in line
+    while (finished.contains(nextToFinish))
+    {
+        PipelineJob next = finished.take(nextToFinish);
+        sink->pipelineDone(next);
+        nextToFinish += 1;
+        done += 1;
+    }
+    reorderMutex.unlock();
+
+    if (done > 0)
+    {
+        QMutexLocker locker(&flightMutex);
+        inFlight -= done;
+        flightChanged.wakeAll();
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef STAGEDEXECUTOR_H
+#define STAGEDEXECUTOR_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QMap>
+#include <QVector>
+#include "filterpipeline.h"
+
+// Receives the frames leaving a StagedExecutor, in submission order
+class PipelineSink
+{
+public:
+    virtual ~PipelineSink() {}
+    virtual void pipelineDone(PipelineJob &job) = 0;
+};
+
+class StagedExecutor;
+
+// Runs one consecutive range of pipeline stages on its own thread and
+// hands each frame on to the next segment
+class SegmentWorker : public QThread
+{
+    Q_OBJECT
+
+public:
+    SegmentWorker(StagedExecutor *executor, int index);
+
+    void setRange(int f, int l);
+    // Takes the job over; the caller's copy is cleared
+    void push(PipelineJob &job);
+    void stopWorker();
+
+protected:
+    void run();
+
+private:
+    StagedExecutor *executor;
+    int index;
+    int first, last;
+    QQueue<PipelineJob> jobs;
+    QMutex queueMutex;
+    QWaitCondition jobReady;
+    bool stopped;
+    ImageCache cache; // derived images of this segment's stages
+};
+
+// Pipeline-parallel execution of a FilterPipeline: the stages are split
+// into segments of about equal cost, each on its own thread, so while one
+// frame is in the feature detectors the next can already be in the
+// morphology. At most maxInFlight frames are in the pipeline at once, and
+// they reach the sink in the order they were submitted. Every
+// DEFAULT_REBALANCE_INTERVAL frames the split is checked against the
+// measured stage times and redone if that makes the slowest segment
+// clearly faster. There are never more segments than stages.
+class StagedExecutor
+{
+public:
+    StagedExecutor(PipelineSink *sink, int segments, int maxInFlight);
+    ~StagedExecutor();
+
+    // Splits the pipeline's stages over the segments again; only call
+    // while nothing is in flight (see drain())
+    void configure(FilterPipeline *pipeline);
+    // Blocks while maxInFlight frames are in flight, or while the frames in
+    // flight drain for a new split
+    void submit(PipelineJob &job);
+    // Returns once every submitted frame has reached the sink
+    void drain();
+    int  getMaxInFlight() const   { return maxInFlight; }
+
+private:
+    friend class SegmentWorker;
+    // Called by segment index once its stages are done
+    void forward(int index, PipelineJob &job);
+    void finish(PipelineJob &job);
+    // Gives the segments the ranges [bounds[i], bounds[i+1]), leaving out
+    // empty ones; nothing may be in flight
+    void apply(const QVector<int> &bounds);
+    void rebalance();
+
+    PipelineSink *sink;
+    FilterPipeline *pipeline;
+    QVector<SegmentWorker*> workers;
+    int maxInFlight;
+    QVector<int> bounds;    // ranges of the segments in use
+    int segments;           // workers in use; the others stay idle
+    int sinceSplit;         // frames submitted since the last split
+
+    QMutex flightMutex;
+    QWaitCondition flightChanged;
+    int inFlight;
+    qint64 nextTicket;
+
+    // Reorder buffer in front of the sink
+    QMutex reorderMutex;
+    QMap<qint64, PipelineJob> finished;
+    qint64 nextToFinish;
+};
+
+#endif // STAGEDEXECUTOR_H
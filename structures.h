@@ -9,12 +9,14 @@ using namespace std;
 // ImageProcessingSettings structure definition
 struct ImageProcessingSettings{
     int saltPepperNoiseDensity;
+    int saltPepperSeed;         // 0: different noise on every run
     int colorSpace;
     int dilateIterations;
     int erodeIterations;
     int openIterations;
     int closeIterations;
     int blurSize;
+    int blurBoxSize;            // kernels this wide or wider use stacked boxes, 0: never
     int sobelDirection;
     int sobelKernelSize;
     int laplacianKernelSize;
@@ -28,11 +30,17 @@ struct ImageProcessingSettings{
     int boundingBoxThres;
     int enclosingCircleThres;
     int harrisCornerThres;
+    int harrisMaxCorners;       // strongest corners kept, 0: all
     int fastThreshold;
     int surfThreshold;
     int siftEdgeThres;
     double siftContrastThres;
     double blurSigma;
+    // FAST/SURF/SIFT on video: run the detector every featureTrackInterval
+    // frames and track the keypoints in between (0 or 1: detect every
+    // frame); detect earlier when fewer than featureTrackMinPoints survive
+    int featureTrackInterval;
+    int featureTrackMinPoints;
 };
 
 // ImageProcessingFlags structure definition
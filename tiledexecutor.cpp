@@ -0,0 +1,95 @@
+#include "tiledexecutor.h"
+#include "parallel.h"
+
+namespace {
+
+// One call of run(); part i is band i
+struct BandJob : public ParallelTask {
+    const QVector<FilterStage*> *stages;
+    int first;
+    int last;
+    cv::Mat src;
+    cv::Mat dst;
+    int rows;       // rows per band
+    int halo;
+    int count;      // bands
+    QVector<TileBand> *bands;
+
+    void run(int i);
+};
+
+void BandJob::run(int i)
+{
+    int y0 = i * rows;
+    int y1 = qMin(y0 + rows, src.rows);
+    int a  = qMax(y0 - halo, 0);
+    int b  = qMin(y1 + halo, src.rows);
+    TileBand &band = (*bands)[i];
+
+    // Every stage spoils at most its radius of rows at a cut band edge,
+    // so after the whole group the rows [y0, y1) are still exact
+    cv::Mat in = src.rowRange(a, b);
+    for (int k=first; k<last; k+=1)
+    {
+        cv::Mat &out = band.buffers[(k - first) & 1];
+        (*stages)[k]->processTile(in, out, band.scratch);
+        in = out;
+    }
+    if (dst.empty())
+        return; // first band: the caller sets up dst and copies it
+    cv::Mat target = dst.rowRange(y0, y1);
+    in.rowRange(y0 - a, y1 - a).copyTo(target);
+}
+
+}
+
+TiledExecutor::TiledExecutor(int b, QThreadPool *p)
+    : tileBytes(b)
+    , pool(p ? p : QThreadPool::globalInstance())
+{
+}
+
+int TiledExecutor::bandRows(const cv::Mat &src, int halo) const
+{
+    int rowBytes = qMax((int) (src.cols * src.elemSize()), 1);
+    int rows = tileBytes / rowBytes;
+    // The halo is computed twice, by both bands next to a cut; keep it a
+    // small share of the band
+    rows = qMax(rows, 4 * halo);
+    return qMax(rows, 8);
+}
+
+bool TiledExecutor::worthTiling(const cv::Mat &src, int halo) const
+{
+    return tileBytes > 0 && src.rows > bandRows(src, halo);
+}
+
+void TiledExecutor::run(const QVector<FilterStage*> &stages, int first, int last, const cv::Mat &src, cv::Mat &dst)
+{
+    int halo = 0;
+    for (int k=first; k<last; k+=1)
+        halo += stages[k]->radius();
+
+    BandJob job;
+    job.stages = &stages;
+    job.first  = first;
+    job.last   = last;
+    job.src    = src;
+    job.halo   = halo;
+    job.rows   = bandRows(src, halo);
+    job.count  = (src.rows + job.rows - 1) / job.rows;
+    job.bands  = &stages[first]->tileBands();
+    if (job.bands->size() < job.count)
+        job.bands->resize(job.count);
+
+    // The first band tells the type of the output
+    job.run(0);
+    const cv::Mat &head = (*job.bands)[0].buffers[(last - first - 1) & 1];
+    dst.create(src.rows, src.cols, head.type());
+    int y1 = qMin(job.rows, src.rows);
+    cv::Mat target = dst.rowRange(0, y1);
+    head.rowRange(0, y1).copyTo(target);
+    job.dst = dst;
+
+    parallelFor(job, 1, job.count, pool);
+}
@@ -0,0 +1,38 @@
+#ifndef TILEDEXECUTOR_H
+#define TILEDEXECUTOR_H
+
+#include <QVector>
+#include <QThreadPool>
+#include <opencv/cv.h>
+#include "filterstage.h"
+#include "config.h"
+
+// Runs consecutive neighbourhood stages band by band. The frame is cut into
+// row bands; each band is read with the halo the whole group needs (the
+// sum of the stage radii), taken through every stage of the group in small
+// per-band buffers that stay in cache, and only its own rows are written
+// to the output. Bands run on a shared thread pool and the calling thread
+// takes its share. A band that reaches an image edge ends with the image,
+// so the border handling there is the same as on the whole frame.
+class TiledExecutor
+{
+public:
+    explicit TiledExecutor(int tileBytes = DEFAULT_TILE_BYTES, QThreadPool *pool = 0);
+
+    void setTileBytes(int b)    { tileBytes = b; }
+    int  getTileBytes() const   { return tileBytes; }
+    // Whether an image would be split into more than one band
+    bool worthTiling(const cv::Mat &src, int halo) const;
+    // Runs stages [first, last), all with radius() >= 0, over src into dst.
+    // The band buffers are those of stages[first]; different groups can run
+    // at the same time.
+    void run(const QVector<FilterStage*> &stages, int first, int last, const cv::Mat &src, cv::Mat &dst);
+
+private:
+    int bandRows(const cv::Mat &src, int halo) const;
+
+    int tileBytes;
+    QThreadPool *pool;
+};
+
+#endif // TILEDEXECUTOR_H
@@ -0,0 +1,115 @@
+#include "videodecoder.h"
+#include <QDebug>
+
+VideoDecoder::VideoDecoder(int prefetchFrames)
+    : QThread()
+    , stopped(0)
+    , pendingSkips(0)
+    , fps(0)
+    , frameCount(0)
+    , position(0)
+{
+    prefetchBuffer = new ImageBuffer(0, prefetchFrames);
+}
+
+VideoDecoder::~VideoDecoder()
+{
+    close();
+    delete prefetchBuffer;
+}
+
+bool VideoDecoder::open(QString fn)
+{
+    stopDecoding();
+
+    capMutex.lock();
+    if (cap.isOpened())
+        cap.release();
+    bool res = cap.open(fn.toStdString());
+    if (res)
+    {
+        // Read once: querying these per frame is not free with every backend
+        fps        = cap.get(CV_CAP_PROP_FPS);
+        frameCount = (int) cap.get(CV_CAP_PROP_FRAME_COUNT);
+        position   = 0;
+    }
+    capMutex.unlock();
+
+    if (res)
+    {
+        stopped.fetchAndStoreOrdered(0);
+        prefetchBuffer->setPolicy(ImageBuffer::Block);
+        start(DEFAULT_DECODE_THREAD_PRIO);
+    }
+    return res;
+}
+
+void VideoDecoder::close()
+{
+    stopDecoding();
+    QMutexLocker locker(&capMutex);
+    if (cap.isOpened())
+        cap.release();
+}
+
+void VideoDecoder::stopDecoding()
+{
+    if (!isRunning())
+        return;
+    stopped.fetchAndStoreOrdered(1);
+    // Let a decoder blocked on the full buffer return
+    prefetchBuffer->setPolicy(ImageBuffer::DropNewest);
+    wait();
+    // Whatever is left belongs to the old file
+    Frame discarded;
+    while (prefetchBuffer->getFrame(discarded, 0))
+        discarded.release();
+    pendingSkips.fetchAndStoreOrdered(0);
+}
+
+void VideoDecoder::skipFrames(int n)
+{
+    Frame discarded;
+    while (n > 0 && prefetchBuffer->getFrame(discarded, 0))
+        n -= 1;
+    if (n > 0)
+        pendingSkips.fetchAndAddOrdered(n);
+}
+
+void VideoDecoder::rewind()
+{
+    cap.set(CV_CAP_PROP_POS_FRAMES, 0);
+    position = 0;
+}
+
+void VideoDecoder::run()
+{
+    while (!loadAcquire(stopped))
+    {
+        capMutex.lock();
+        // Skipped frames are demuxed and decoded but never converted
+        while (loadAcquire(pendingSkips) > 0)
+        {
+            pendingSkips.fetchAndAddOrdered(-1);
+            if (!cap.grab())
+                rewind();
+            else
+                position += 1;
+        }
+
+        cv::Mat &buffer = framePool.acquire();
+        bool ok = cap.grab() && cap.retrieve(buffer);
+        if (ok)
+            position += 1;
+        // Loop at the end of the file; this happens here, ahead of playback
+        if (!ok || (frameCount > 0 && position >= frameCount-1))
+            rewind();
+        capMutex.unlock();
+
+        if (!ok)
+            continue;
+        Frame decoded(buffer, true);
+        // Blocks while the prefetch buffer is full
+        prefetchBuffer->passFrame(decoded);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef VIDEODECODER_H
+#define VIDEODECODER_H
+
+#include <QThread>
+#include <QMutex>
+#include "atomicint.h"
+#include <opencv/highgui.h>
+#include "imagebuffer.h"
+#include "frame.h"
+#include "config.h"
+
+// Decodes a video file ahead of playback on its own thread. Up to
+// prefetchFrames decoded frames wait in a bounded buffer, so decoding cost
+// and the rewind at the end of the file are absorbed here instead of
+// stalling the capture and processing threads. Frames being skipped are
+// only grabbed, never retrieved (converted).
+class VideoDecoder : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit VideoDecoder(int prefetchFrames = DEFAULT_PREFETCH_FRAMES);
+    ~VideoDecoder();
+
+    // Stops decoding, opens the file and starts prefetching it
+    bool open(QString fn);
+    // Stops decoding and releases the file
+    void close();
+    bool isOpened()         { QMutexLocker locker(&capMutex); return cap.isOpened(); }
+    double getFps() const   { return fps; }
+    int  getFrameCount() const { return frameCount; }
+    int  getWidth()         { QMutexLocker locker(&capMutex); return cap.get(CV_CAP_PROP_FRAME_WIDTH); }
+    int  getHeight()        { QMutexLocker locker(&capMutex); return cap.get(CV_CAP_PROP_FRAME_HEIGHT); }
+
+    // Next decoded frame; false if none arrived within timeoutMs
+    bool getFrame(Frame &frame, int timeoutMs) { return prefetchBuffer->getFrame(frame, timeoutMs); }
+    // Drop n frames: already decoded ones first, the rest without decoding
+    void skipFrames(int n);
+
+protected:
+    void run();
+
+private:
+    void stopDecoding();
+    void rewind();
+
+    cv::VideoCapture cap;
+    ImageBuffer *prefetchBuffer;
+    FramePool framePool;
+    QMutex capMutex;
+    QAtomicInt stopped;
+    QAtomicInt pendingSkips;
+    double fps;
+    int frameCount;
+    int position;
+};
+
+#endif // VIDEODECODER_H